@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 128 are exact, larger values keep 6 significant bits (< 1.6% error).
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts_(kBuckets, 0), total_(0), max_(0), sum_(0) {}
+
+    void record(uint64_t value) {
+        counts_[bucketOf(value)]++;
+        total_++;
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    uint64_t mean() const { return total_ == 0 ? 0 : sum_ / total_; }
+
+    // Lower bound of the bucket holding the `q` quantile
+    uint64_t percentile(double q) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total_));
+        rank = std::min(std::max<uint64_t>(rank, 1), total_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(valueOf(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    // Non-empty buckets as [lowest value, count] pairs, for merging offline
+    template <typename Fn> void forEachBucket(Fn fn) const {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] != 0) {
+                fn(valueOf(i), counts_[i]);
+            }
+        }
+    }
+
+private:
+    static constexpr unsigned kSubBits = 7;
+    static constexpr uint64_t kSubCount = 1ULL << kSubBits;       // 128
+    static constexpr uint64_t kHalf = kSubCount / 2;              // 64
+    static constexpr size_t kBuckets = kSubCount + (64 - kSubBits) * kHalf;
+
+    static size_t bucketOf(uint64_t v) {
+        if (v < kSubCount) {
+            return static_cast<size_t>(v);
+        }
+        unsigned msb = 63U - static_cast<unsigned>(__builtin_clzll(v));
+        unsigned shift = msb - (kSubBits - 1);
+        return static_cast<size_t>(kSubCount + (shift - 1) * kHalf + ((v >> shift) - kHalf));
+    }
+
+    static uint64_t valueOf(size_t idx) {
+        if (idx < kSubCount) {
+            return idx;
+        }
+        uint64_t rel = idx - kSubCount;
+        uint64_t shift = rel / kHalf + 1;
+        return (kHalf + rel % kHalf) << shift;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    uint64_t sum_;
+};
+
+// Per-process benchmark record for da_proc's --bench mode: counts
+// broadcasts/deliveries and their broadcast-to-delivery latency, written as
+// JSON once all expected deliveries happened and again at exit. Timestamps
+// are CLOCK_MONOTONIC microseconds, which every process on the same machine
+// shares.
+class BenchStats {
+public:
+    static uint64_t nowUs() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void enable(const std::string& path, unsigned long id, const std::string& mode, uint64_t expected) {
+        path_ = path;
+        id_ = id;
+        mode_ = mode;
+        expected_ = expected;
+    }
+
+    bool enabled() const { return !path_.empty(); }
+
+    void onBroadcast(uint64_t atUs) {
+        if (broadcasts_ == 0) {
+            startUs_ = atUs;
+        }
+        broadcasts_++;
+    }
+
+    void onDelivery(uint64_t sentUs, uint64_t atUs) {
+        if (startUs_ == 0) {
+            startUs_ = atUs;
+        }
+        endUs_ = atUs;
+        latency_.record(atUs > sentUs ? atUs - sentUs : 0);
+        if (latency_.count() == expected_) {
+            write();
+        }
+    }
+
+    void write() const {
+        std::ofstream out(path_);
+        uint64_t durationUs = endUs_ > startUs_ ? endUs_ - startUs_ : 0;
+        double seconds = static_cast<double>(durationUs) / 1e6;
+
+        out << "{\"id\": " << id_ << ", \"mode\": \"" << mode_ << "\""
+            << ", \"broadcasts\": " << broadcasts_
+            << ", \"deliveries\": " << latency_.count()
+            << ", \"duration_us\": " << durationUs
+            << ", \"throughput_per_sec\": "
+            << (seconds > 0 ? static_cast<double>(latency_.count()) / seconds : 0.0)
+            << ", \"latency_us\": {\"mean\": " << latency_.mean()
+            << ", \"p50\": " << latency_.percentile(0.50)
+            << ", \"p99\": " << latency_.percentile(0.99)
+            << ", \"p999\": " << latency_.percentile(0.999)
+            << ", \"max\": " << latency_.max() << "}"
+            << ", \"histogram\": [";
+        bool first = true;
+        latency_.forEachBucket([&](uint64_t value, uint64_t count) {
+            out << (first ? "" : ", ") << "[" << value << ", " << count << "]";
+            first = false;
+        });
+        out << "]}\n";
+    }
+
+private:
+    std::string path_;
+    unsigned long id_ = 0;
+    std::string mode_;
+    uint64_t expected_ = 0;
+    uint64_t broadcasts_ = 0;
+    uint64_t startUs_ = 0;
+    uint64_t endUs_ = 0;
+    LatencyHistogram latency_;
+};
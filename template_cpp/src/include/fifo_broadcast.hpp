@@ -1,20 +1,22 @@
 #pragma once
 
 #include "urb.hpp"
+#include "pool_allocator.hpp"
 #include <map>
 #include <iostream>
 
+// Broadcasts through `Urb`; deliveries go to `Upper::fifoDeliver(from, msg)`.
+template <typename Urb, typename Upper>
 class FIFOBroadcast {
 public:
-    using DeliverCallback = std::function<void(unsigned long from, const Message& msg)>;
-
-    FIFOBroadcast(unsigned long myId, UniformReliableBroadcast& urb, DeliverCallback callback)
-        : myId_(myId), urb_(urb), callback_(callback), mySeq_(0) {}
+    FIFOBroadcast(unsigned long myId, Urb& urb, Upper& upper)
+        : myId_(myId), urb_(urb), upper_(upper), mySeq_(0) {}
 
     void broadcast(const Message& msg) {
         Message taggedMsg = msg;
-        taggedMsg.original_sender_id = myId_;
-        taggedMsg.original_seq_no = ++mySeq_;
+        taggedMsg.original_sender_id = static_cast<uint32_t>(myId_);
+        taggedMsg.original_seq_no = static_cast<uint32_t>(++mySeq_);
+        stats_.broadcasts.add();
         
         urb_.broadcast(taggedMsg);
     }
@@ -23,28 +25,61 @@ public:
         unsigned long sender = msg.original_sender_id;
         unsigned long seq = msg.original_seq_no;
         
-        if (nextSeq_.find(sender) == nextSeq_.end()) {
-            nextSeq_[sender] = 1;
+        unsigned long& next = nextSeq_.try_emplace(sender, 1).first->second;
+
+        // In order: deliver straight away without buffering
+        if (seq == next) {
+            stats_.delivered.add();
+            DA_TRACE_EVENT(FifoDeliver, 0, sender, seq);
+            upper_.fifoDeliver(sender, msg);
+            next++;
+        } else if (seq > next) {
+            buffer_[sender].try_emplace(seq, msg);
+            return;
+        } else {
+            return;
         }
-        
-        buffer_[sender][seq] = msg;
-        
-        while (buffer_[sender].count(nextSeq_[sender])) {
-            Message nextMsg = buffer_[sender][nextSeq_[sender]];
-            buffer_[sender].erase(nextSeq_[sender]);
-            
-            callback_(sender, nextMsg);
-            
-            nextSeq_[sender]++;
+
+        auto bufferIt = buffer_.find(sender);
+        if (bufferIt == buffer_.end()) {
+            return;
+        }
+        auto& pending = bufferIt->second;
+        for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.begin()) {
+            auto node = pending.extract(it);
+
+            stats_.delivered.add();
+            DA_TRACE_EVENT(FifoDeliver, 0, sender, next);
+            upper_.fifoDeliver(sender, node.mapped());
+
+            next++;
         }
     }
 
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("fifo.broadcasts", stats_.broadcasts);
+        registry.add("fifo.delivered", stats_.delivered);
+        registry.add("fifo.reorder_buffered", [this]() noexcept {
+            uint64_t total = 0;
+            for (const auto& [sender, msgs] : buffer_) {
+                total += msgs.size();
+            }
+            return total;
+        });
+    }
+
 private:
+    struct Stats {
+        Counter broadcasts;
+        Counter delivered;
+    };
+
     unsigned long myId_;
-    UniformReliableBroadcast& urb_;
-    DeliverCallback callback_;
+    Urb& urb_;
+    Upper& upper_;
 
-    std::map<unsigned long, unsigned long> nextSeq_;
-    std::map<unsigned long, std::map<unsigned long, Message>> buffer_;
+    PoolMap<unsigned long, unsigned long> nextSeq_;
+    PoolMap<unsigned long, PoolMap<unsigned long, Message>> buffer_;
     unsigned long mySeq_;
+    Stats stats_;
 };
@@ -8,155 +8,301 @@
 #include <sstream>
 #include <algorithm>
 #include <iostream>
+#include "trace.hpp"
+#include "pool_allocator.hpp"
+#include <charconv>
 
+// Sends through `Link` (a PerfectLink); decisions go to
+// `Upper::decide(slot, value)` with `value` an ordered set of ints.
+//
+// Proposals, ACKs and NACKs are not sent one message per slot: they are
+// queued per destination and go out as one LA_BATCH message per destination
+// on flush(), which runs after every received message and from the event
+// loop. The batch payload is a list of records
+// "TYPE SLOT PROPOSAL_NUMBER COUNT V1 .. VCOUNT".
+template <typename Link, typename Upper>
 class LatticeAgreement {
 public:
-    using DecideCallback = std::function<void(int slot, const std::set<int>& value)>;
+    static bool handles(MessageType type) {
+        return type == MessageType::LA_BATCH || type == MessageType::LA_PROPOSAL ||
+               type == MessageType::LA_ACK || type == MessageType::LA_NACK;
+    }
 
-    LatticeAgreement(unsigned long myId, PerfectLink& pl, int numProcesses, DecideCallback callback)
-        : myId_(myId), pl_(pl), numProcesses_(numProcesses), callback_(callback), pl_seq_(0) {}
+    LatticeAgreement(unsigned long myId, Link& pl, int numProcesses, Upper& upper)
+        : myId_(myId), pl_(pl), numProcesses_(numProcesses), upper_(upper), pl_seq_(0) {}
 
     void propose(int slot, const std::set<int>& value) {
         InstanceState& state = instances_[slot];
         if (state.decided) return; // Should not happen if used correctly, but safeguard
 
         state.active = true;
-        state.proposed_value = value;
+        state.proposed_value = ValueSet(value.begin(), value.end());
         state.active_proposal_number++; // Starts at 0, so first is 1
         state.ack_count = 0;
         state.nack_count = 0;
+        stats_.proposals.add();
+        stats_.rounds.add();
         
         // Broadcast proposal
-        // std::cout << "Node " << myId_ << " Proposing slot " << slot << " prop_num " << state.active_proposal_number << " val " << serializeSet(state.proposed_value) << "\n";
+        DA_TRACE_EVENT(Propose, 0, static_cast<uint64_t>(slot), state.active_proposal_number);
         broadcast(slot, MessageType::LA_PROPOSAL, state.active_proposal_number, state.proposed_value);
     }
 
     void receive(unsigned long from, const Message& msg) {
-        // Map message fields back to LA semantics
-        // original_sender_id -> slot_number
-        // original_seq_no -> proposal_number
-        int slot = static_cast<int>(msg.original_sender_id);
-        int proposal_number = static_cast<int>(msg.original_seq_no);
-        
-        InstanceState& state = instances_[slot];
-        
-        switch (msg.type) {
-            case MessageType::LA_PROPOSAL: {
-                handleProposal(from, slot, proposal_number, parseSet(msg.payload), state);
-                break;
+        if (msg.type == MessageType::LA_BATCH) {
+            receiveBatch(from, msg.payload);
+        } else {
+            // Map message fields back to LA semantics
+            // original_sender_id -> slot_number
+            // original_seq_no -> proposal_number
+            int slot = static_cast<int>(msg.original_sender_id);
+            int proposal_number = static_cast<int>(msg.original_seq_no);
+            handleRecord(from, msg.type, slot, proposal_number, parseSet(msg.payload));
+        }
+
+        // Replies to everything in this message go out together
+        flush();
+    }
+
+    // Sends the queued records, one message per destination
+    void flush() {
+        for (auto& [target, batch] : outbox_) {
+            if (batch.records > 0) {
+                sendBatch(target, batch);
             }
-            case MessageType::LA_ACK: {
-                handleAck(slot, proposal_number, state);
-                break;
+        }
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("la.proposals", stats_.proposals);
+        registry.add("la.rounds", stats_.rounds);
+        registry.add("la.decided", stats_.decided);
+        registry.add("la.acks_received", stats_.acksReceived);
+        registry.add("la.nacks_received", stats_.nacksReceived);
+        registry.add("la.proposals_accepted", stats_.accepted);
+        registry.add("la.proposals_rejected", stats_.rejected);
+        registry.add("la.batches_sent", stats_.batchesSent);
+        registry.add("la.records_sent", stats_.recordsSent);
+        registry.add("la.active_slots", [this]() noexcept {
+            uint64_t active = 0;
+            for (const auto& [slot, state] : instances_) {
+                active += state.active ? 1 : 0;
             }
-            case MessageType::LA_NACK: {
-                handleNack(slot, proposal_number, parseSet(msg.payload), state);
-                break;
+            return active;
+        });
+        registry.add("la.max_rounds_per_slot", [this]() noexcept {
+            uint64_t rounds = 0;
+            for (const auto& [slot, state] : instances_) {
+                rounds = std::max<uint64_t>(rounds, state.active_proposal_number);
             }
-            default:
-                break;
-        }
+            return rounds;
+        });
     }
 
 private:
+    // Node-pooled set for the values that churn on every proposal
+    using ValueSet = PoolSet<int>;
+
+    struct Stats {
+        Counter proposals;
+        Counter rounds;
+        Counter decided;
+        Counter acksReceived;
+        Counter nacksReceived;
+        Counter accepted;
+        Counter rejected;
+        Counter batchesSent;
+        Counter recordsSent;
+    };
+
+    // Records queued for one destination
+    struct Batch {
+        std::string payload;
+        size_t records = 0;
+    };
+
+    // A batch is sent early once it grows past this, to bound datagram size
+    static constexpr size_t kMaxBatchBytes = 32 * 1024;
+
     struct InstanceState {
         // Proposer state
         bool active = false;
         size_t ack_count = 0;
         size_t nack_count = 0;
         size_t active_proposal_number = 0;
-        std::set<int> proposed_value;
+        ValueSet proposed_value;
         bool decided = false;
         
         // Acceptor state
-        std::set<int> accepted_value;
+        ValueSet accepted_value;
     };
 
     unsigned long myId_;
-    PerfectLink& pl_;
+    Link& pl_;
     int numProcesses_;
-    DecideCallback callback_;
+    Upper& upper_;
     unsigned long pl_seq_;
     
-    std::map<int, InstanceState> instances_;
-
-    // Helper: Serialize set to string "1 2 3"
-    std::string serializeSet(const std::set<int>& s) {
-        std::ostringstream oss;
-        bool first = true;
-        for (int x : s) {
-            if (!first) oss << " ";
-            oss << x;
-            first = false;
-        }
-        return oss.str();
-    }
-    
+    PoolMap<int, InstanceState> instances_;
+
+    // Outgoing records per destination
+    PoolMap<unsigned long, Batch> outbox_;
+
+    Stats stats_;
+
     // Helper: Deserialize string to set
-    std::set<int> parseSet(const std::string& s) {
-        std::set<int> res;
-        std::istringstream iss(s);
-        int val;
-        while (iss >> val) {
-            res.insert(val);
+    ValueSet parseSet(std::string_view s) {
+        ValueSet res;
+        const char* p = s.data();
+        const char* end = p + s.size();
+        while (p < end) {
+            if (*p == ' ') {
+                ++p;
+                continue;
+            }
+            int val;
+            auto result = std::from_chars(p, end, val);
+            if (result.ec != std::errc()) {
+                break;
+            }
+            res.insert(res.end(), val);
+            p = result.ptr;
         }
         return res;
     }
 
-    void broadcast(int slot, MessageType type, size_t proposal_number, const std::set<int>& payloadSet = {}) {
-        Message msg;
-        msg.type = type;
-        msg.original_sender_id = static_cast<unsigned long>(slot);
-        msg.original_seq_no = static_cast<unsigned long>(proposal_number);
-        msg.payload = serializeSet(payloadSet);
-        msg.sender_id = myId_;
-        
+    static void appendNumber(std::string& out, long long value) {
+        char buf[24];
+        if (!out.empty()) out += ' ';
+        out.append(buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), value).ptr - buf));
+    }
+
+    template <typename T>
+    static bool nextNumber(const char*& p, const char* end, T& value) {
+        while (p < end && *p == ' ') {
+            ++p;
+        }
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    void receiveBatch(unsigned long from, std::string_view payload) {
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        int type;
+        int slot;
+        int proposal_number;
+        size_t count;
+        while (nextNumber(p, end, type) && nextNumber(p, end, slot) &&
+               nextNumber(p, end, proposal_number) && nextNumber(p, end, count)) {
+            ValueSet values;
+            for (size_t i = 0; i < count; ++i) {
+                int val;
+                if (!nextNumber(p, end, val)) {
+                    return;
+                }
+                values.insert(values.end(), val);
+            }
+            handleRecord(from, static_cast<MessageType>(type), slot, proposal_number, values);
+        }
+    }
+
+    void handleRecord(unsigned long from, MessageType type, int slot, int proposal_number, const ValueSet& values) {
+        InstanceState& state = instances_[slot];
+
+        switch (type) {
+            case MessageType::LA_PROPOSAL: {
+                handleProposal(from, slot, proposal_number, values, state);
+                break;
+            }
+            case MessageType::LA_ACK: {
+                handleAck(from, slot, proposal_number, state);
+                break;
+            }
+            case MessageType::LA_NACK: {
+                handleNack(from, slot, proposal_number, values, state);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void broadcast(int slot, MessageType type, size_t proposal_number, const ValueSet& payloadSet = {}) {
         for (int i = 1; i <= numProcesses_; ++i) {
-            msg.seq_no = ++pl_seq_; // Unique seq for PL
-            pl_.send(i, msg);
+            send(static_cast<unsigned long>(i), slot, type, proposal_number, payloadSet);
+        }
+    }
+
+    // Queues one record for `target`
+    void send(unsigned long target, int slot, MessageType type, size_t proposal_number, const ValueSet& payloadSet = {}) {
+        Batch& batch = outbox_[target];
+        appendNumber(batch.payload, static_cast<int>(type));
+        appendNumber(batch.payload, slot);
+        appendNumber(batch.payload, static_cast<long long>(proposal_number));
+        appendNumber(batch.payload, static_cast<long long>(payloadSet.size()));
+        for (int x : payloadSet) {
+            appendNumber(batch.payload, x);
+        }
+        batch.records++;
+        stats_.recordsSent.add();
+
+        if (batch.payload.size() >= kMaxBatchBytes) {
+            sendBatch(target, batch);
         }
     }
 
-    void send(unsigned long target, int slot, MessageType type, size_t proposal_number, const std::set<int>& payloadSet = {}) {
+    void sendBatch(unsigned long target, Batch& batch) {
         Message msg;
-        msg.type = type;
-        msg.sender_id = myId_;
-        msg.original_sender_id = static_cast<unsigned long>(slot);
-        msg.original_seq_no = static_cast<unsigned long>(proposal_number);
-        msg.payload = serializeSet(payloadSet);
-        msg.seq_no = ++pl_seq_;
-        
+        msg.type = MessageType::LA_BATCH;
+        msg.sender_id = static_cast<uint32_t>(myId_);
+        msg.seq_no = ++pl_seq_; // Unique seq for PL
+        msg.original_sender_id = 0;
+        msg.original_seq_no = 0;
+        msg.payload = batch.payload;
         pl_.send(target, msg);
+        stats_.batchesSent.add();
+
+        batch.payload.clear();
+        batch.records = 0;
     }
 
-    void handleProposal(unsigned long from, int slot, int proposal_number, const std::set<int>& proposed_value, InstanceState& state) {
+    void handleProposal(unsigned long from, int slot, int proposal_number, const ValueSet& proposed_value, InstanceState& state) {
         // Acceptor Logic
         if (isSubset(state.accepted_value, proposed_value)) {
             state.accepted_value = proposed_value;
+            stats_.accepted.add();
             // Send ACK
             send(from, slot, MessageType::LA_ACK, proposal_number);
         } else {
             // Merge and send NACK
+            stats_.rejected.add();
             state.accepted_value.insert(proposed_value.begin(), proposed_value.end());
             send(from, slot, MessageType::LA_NACK, proposal_number, state.accepted_value);
         }
     }
 
-    void handleAck(int slot, int proposal_number, InstanceState& state) {
+    void handleAck(unsigned long from, int slot, int proposal_number, InstanceState& state) {
         // Proposer Logic
+        stats_.acksReceived.add();
+        DA_TRACE_EVENT(LaAck, from, static_cast<uint64_t>(slot), static_cast<uint64_t>(proposal_number));
         if (state.active && static_cast<size_t>(proposal_number) == state.active_proposal_number) {
             state.ack_count++;
-            // std::cout << "Node " << myId_ << " Got ACK from ? for slot " << slot << " cnt " << state.ack_count << "\n";
             checkProposerCondition(slot, state);
         }
     }
 
-    void handleNack(int slot, int proposal_number, const std::set<int>& value, InstanceState& state) {
+    void handleNack(unsigned long from, int slot, int proposal_number, const ValueSet& value, InstanceState& state) {
         // Proposer Logic
+        stats_.nacksReceived.add();
+        DA_TRACE_EVENT(Nack, from, static_cast<uint64_t>(slot), static_cast<uint64_t>(proposal_number));
         if (state.active && static_cast<size_t>(proposal_number) == state.active_proposal_number) {
             state.proposed_value.insert(value.begin(), value.end());
             state.nack_count++;
-            // std::cout << "Node " << myId_ << " Got NACK from ? for slot " << slot << " cnt " << state.nack_count << "\n";
             checkProposerCondition(slot, state);
         }
     }
@@ -175,19 +321,21 @@ private:
             state.active_proposal_number++;
             state.ack_count = 0;
             state.nack_count = 0;
-            // std::cout << "Node " << myId_ << " Retrying slot " << slot << "\n";
+            stats_.rounds.add();
+            DA_TRACE_EVENT(Propose, 0, static_cast<uint64_t>(slot), state.active_proposal_number);
             broadcast(slot, MessageType::LA_PROPOSAL, state.active_proposal_number, state.proposed_value);
         } else if (state.ack_count >= quorum) {
             // Majority ACKs -> Decide
             state.decided = true;
             state.active = false;
-            // std::cout << "Node " << myId_ << " Decided slot " << slot << "\n";
-            callback_(slot, state.proposed_value);
+            stats_.decided.add();
+            DA_TRACE_EVENT(Decide, 0, static_cast<uint64_t>(slot), state.active_proposal_number);
+            upper_.decide(slot, state.proposed_value);
         }
     }
 
     
-    bool isSubset(const std::set<int>& a, const std::set<int>& b) {
+    bool isSubset(const ValueSet& a, const ValueSet& b) {
         return std::includes(b.begin(), b.end(), a.begin(), a.end());
     }
 };
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <charconv>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. Parsing works directly on the
+// mapped bytes, so the only cost is the page-ins of the file itself.
+class MappedFile {
+public:
+  explicit MappedFile(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      std::ostringstream os;
+      os << "`" << path << "` does not exist.";
+      throw std::invalid_argument(os.str());
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      ::close(fd);
+      throw std::runtime_error("Could not stat `" + std::string(path) + "`");
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Could not mmap `" + std::string(path) + "`");
+      }
+      madvise(addr, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(addr);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view view() const { return std::string_view(data_, size_); }
+
+  bool empty() const { return size_ == 0; }
+
+  // Pops the next line (without the trailing '\n') off the front of `rest`.
+  // Returns false once `rest` is exhausted.
+  static bool nextLine(std::string_view &rest, std::string_view &line) {
+    if (rest.empty()) {
+      return false;
+    }
+
+    size_t nl = rest.find('\n');
+    if (nl == std::string_view::npos) {
+      line = rest;
+      rest = std::string_view();
+    } else {
+      line = rest.substr(0, nl);
+      rest.remove_prefix(nl + 1);
+    }
+    return true;
+  }
+
+  static void skipSpaces(std::string_view &s) {
+    size_t i = 0;
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' ||
+                            s[i] == '\v' || s[i] == '\f')) {
+      ++i;
+    }
+    s.remove_prefix(i);
+  }
+
+  // Parses the next whitespace-separated integer of `s` and advances past it.
+  template <typename T> static bool nextNumber(std::string_view &s, T &out) {
+    skipSpaces(s);
+    auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+    if (res.ec != std::errc()) {
+      return false;
+    }
+    s.remove_prefix(static_cast<size_t>(res.ptr - s.data()));
+    return true;
+  }
+
+  // Parses the next whitespace-separated token of `s` and advances past it.
+  static std::string_view nextToken(std::string_view &s) {
+    skipSpaces(s);
+    size_t i = 0;
+    while (i < s.size() && s[i] != ' ' && s[i] != '\t' && s[i] != '\r' &&
+           s[i] != '\v' && s[i] != '\f') {
+      ++i;
+    }
+    std::string_view tok = s.substr(0, i);
+    s.remove_prefix(i);
+    return tok;
+  }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
@@ -1,52 +1,295 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
 #include <iostream>
 
-enum class MessageType {
+enum class MessageType : uint8_t {
     PL_ACK,
     URB_MSG,
     LA_PROPOSAL,
     LA_ACK,
-    LA_NACK
+    LA_NACK,
+    PL_HEARTBEAT,
+    URB_VOTE,
+    URB_REQUEST,
+    LA_BATCH,
+    PL_FRAGMENT,
+    PL_FRAGMENT_ACK
 };
 
+// Message payload with small-buffer storage. Payloads of up to kInline bytes
+// (FIFO sequence numbers, benchmark timestamps, empty ACK payloads) live
+// inside the object; larger ones (LA sets, URB vote batches) go to a
+// reference-counted heap block that copies share, so relaying or queueing a
+// large payload never copies its bytes. Shared blocks are immutable: writing
+// to a payload whose block has other owners allocates a new one.
+class Payload {
+public:
+    static constexpr size_t kInline = 23;
+
+    Payload() { raw_[kTagByte] = 0; }
+
+    Payload(std::string_view s) : Payload() { assign(s.data(), s.size()); }
+
+    Payload(const Payload& other) {
+        std::memcpy(raw_, other.raw_, sizeof(raw_));
+        if (isHeap()) {
+            block()->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Payload(Payload&& other) noexcept {
+        std::memcpy(raw_, other.raw_, sizeof(raw_));
+        other.raw_[kTagByte] = 0;
+    }
+
+    Payload& operator=(const Payload& other) {
+        if (this != &other) {
+            Payload copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    Payload& operator=(Payload&& other) noexcept {
+        if (this != &other) {
+            release();
+            std::memcpy(raw_, other.raw_, sizeof(raw_));
+            other.raw_[kTagByte] = 0;
+        }
+        return *this;
+    }
+
+    Payload& operator=(std::string_view s) {
+        assign(s.data(), s.size());
+        return *this;
+    }
+
+    ~Payload() { release(); }
+
+    void assign(const char* data, size_t size) {
+        if (size <= kInline) {
+            release();
+            std::memcpy(raw_, data, size);
+            raw_[kTagByte] = static_cast<unsigned char>(size);
+            return;
+        }
+
+        // Reuse our block if we are its only owner and it is large enough
+        if (!isHeap() || block()->refs.load(std::memory_order_relaxed) != 1 || block()->capacity < size) {
+            Block* fresh = Block::create(size);
+            release();
+            setBlock(fresh);
+        }
+        std::memmove(block()->data(), data, size);
+        block()->size = static_cast<uint32_t>(size);
+    }
+
+    // Makes the payload `size` bytes of unspecified content that no other
+    // payload shares and returns them for writing
+    char* resize(size_t size) {
+        if (size <= kInline) {
+            release();
+            raw_[kTagByte] = static_cast<unsigned char>(size);
+            return reinterpret_cast<char*>(raw_);
+        }
+
+        if (!isHeap() || block()->refs.load(std::memory_order_relaxed) != 1 || block()->capacity < size) {
+            Block* fresh = Block::create(size);
+            release();
+            setBlock(fresh);
+        }
+        block()->size = static_cast<uint32_t>(size);
+        return block()->data();
+    }
+
+    // Appends in place while we own the block and it has room; otherwise
+    // moves to a block at least twice the current size, so building a
+    // payload by repeated appends (URB vote batches) is amortized linear
+    Payload& operator+=(std::string_view s) {
+        size_t old = size();
+        size_t total = old + s.size();
+        if (total <= kInline) {
+            std::memmove(raw_ + old, s.data(), s.size());
+            raw_[kTagByte] = static_cast<unsigned char>(total);
+            return *this;
+        }
+
+        if (!isHeap() || block()->refs.load(std::memory_order_relaxed) != 1 || block()->capacity < total) {
+            // `s` may point into our current bytes, so copy before release
+            Block* fresh = Block::create(std::max(total, 2 * old));
+            std::memcpy(fresh->data(), data(), old);
+            std::memcpy(fresh->data() + old, s.data(), s.size());
+            fresh->size = static_cast<uint32_t>(total);
+            release();
+            setBlock(fresh);
+        } else {
+            std::memmove(block()->data() + old, s.data(), s.size());
+            block()->size = static_cast<uint32_t>(total);
+        }
+        return *this;
+    }
+
+    Payload& operator+=(char c) { return *this += std::string_view(&c, 1); }
+
+    const char* data() const {
+        return isHeap() ? block()->data() : reinterpret_cast<const char*>(raw_);
+    }
+
+    size_t size() const { return isHeap() ? block()->size : raw_[kTagByte]; }
+    bool empty() const { return size() == 0; }
+
+    std::string_view view() const { return std::string_view(data(), size()); }
+    operator std::string_view() const { return view(); }
+
+    void swap(Payload& other) noexcept {
+        unsigned char tmp[sizeof(raw_)];
+        std::memcpy(tmp, raw_, sizeof(raw_));
+        std::memcpy(raw_, other.raw_, sizeof(raw_));
+        std::memcpy(other.raw_, tmp, sizeof(raw_));
+    }
+
+private:
+    struct Block {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+        uint32_t capacity;
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+
+        static Block* create(size_t capacity) {
+            void* mem = ::operator new(sizeof(Block) + capacity);
+            Block* b = new (mem) Block;
+            b->refs.store(1, std::memory_order_relaxed);
+            b->size = 0;
+            b->capacity = static_cast<uint32_t>(capacity);
+            return b;
+        }
+    };
+
+    static constexpr size_t kTagByte = kInline;
+    static constexpr unsigned char kHeapTag = 0xff;
+
+    bool isHeap() const { return raw_[kTagByte] == kHeapTag; }
+
+    Block* block() const {
+        Block* b;
+        std::memcpy(&b, raw_, sizeof(b));
+        return b;
+    }
+
+    void setBlock(Block* b) {
+        std::memcpy(raw_, &b, sizeof(b));
+        raw_[kTagByte] = kHeapTag;
+    }
+
+    void release() {
+        if (isHeap()) {
+            Block* b = block();
+            if (b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                b->~Block();
+                ::operator delete(b);
+            }
+            raw_[kTagByte] = 0;
+        }
+    }
+
+    // Inline bytes, or the Block pointer; the last byte holds the inline
+    // size or kHeapTag
+    alignas(8) unsigned char raw_[kInline + 1];
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Payload& payload) {
+    return os << payload.view();
+}
+
+// Header fields are sized for the deployment limits (process ids and LA
+// slots fit 32 bits, FIFO sequence numbers are ints); the PL sequence
+// number counts every packet sent and keeps 64 bits. 48 bytes in total.
 struct Message {
     MessageType type;
-    unsigned long sender_id;
-    unsigned long seq_no;
-    unsigned long original_sender_id; // For URB
-    unsigned long original_seq_no;    // For URB
-    std::string payload;
+    uint32_t sender_id;
+    uint64_t seq_no;
+    uint32_t original_sender_id; // For URB
+    uint32_t original_seq_no;    // For URB
+    Payload payload;
 
     // Serialize message to string
     // Format: TYPE SENDER_ID SEQ_NO ORIG_SENDER ORIG_SEQ PAYLOAD
     std::string serialize() const {
-        std::ostringstream oss;
-        oss << static_cast<int>(type) << " " 
-            << sender_id << " " 
-            << seq_no << " "
-            << original_sender_id << " "
-            << original_seq_no << " "
-            << payload;
-        return oss.str();
+        std::string out;
+        serializeTo(out);
+        return out;
+    }
+
+    // Same as serialize(), into a caller-owned buffer so its capacity is reused
+    void serializeTo(std::string& out) const {
+        out.clear();
+        appendField(out, static_cast<int>(type));
+        appendField(out, sender_id);
+        appendField(out, seq_no);
+        appendField(out, original_sender_id);
+        appendField(out, original_seq_no);
+        out.append(payload.view());
     }
 
     // Deserialize string to message
     static bool deserialize(const std::string& data, Message& msg) {
-        std::istringstream iss(data);
+        const char* p = data.data();
+        const char* end = p + data.size();
+
         int typeInt;
-        if (!(iss >> typeInt >> msg.sender_id >> msg.seq_no >> msg.original_sender_id >> msg.original_seq_no)) {
+        if (!parseField(p, end, typeInt) || !parseField(p, end, msg.sender_id) ||
+            !parseField(p, end, msg.seq_no) || !parseField(p, end, msg.original_sender_id) ||
+            !parseField(p, end, msg.original_seq_no)) {
             return false;
         }
         msg.type = static_cast<MessageType>(typeInt);
-        
-        // Read remaining payload (handling spaces)
-        char space;
-        iss.get(space); // Consume the space after the last number
-        std::getline(iss, msg.payload);
+
+        // Remaining payload (handling spaces) after the separator, up to a newline
+        if (p < end) {
+            ++p;
+        }
+        const char* eol = std::find(p, end, '\n');
+        msg.payload.assign(p, static_cast<size_t>(eol - p));
+        return true;
+    }
+
+private:
+    // Number followed by the field separator
+    template <typename T>
+    static void appendField(std::string& out, T value) {
+        char buf[24];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, static_cast<size_t>(result.ptr - buf));
+        out += ' ';
+    }
+
+    // Whitespace separated number, as `istream >> value` reads it
+    template <typename T>
+    static bool parseField(const char*& p, const char* end, T& value) {
+        while (p < end && std::isspace(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        p = result.ptr;
         return true;
     }
 };
+
+static_assert(sizeof(Payload) == 24, "Payload layout changed");
+static_assert(sizeof(Message) == 48, "Message layout changed");
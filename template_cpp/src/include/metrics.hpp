@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+
+// Event counter owned by the thread that updates it. Increments are a
+// relaxed load + store (no locked instruction); other threads may read a
+// consistent, possibly slightly stale value at any time.
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Named counters and gauges of one process, dumped as a flat JSON object.
+// Gauges (queue depths and the like) are computed only when dumped so they
+// add nothing to the message path.
+class MetricsRegistry {
+public:
+    using Gauge = std::function<uint64_t()>;
+
+    void add(const std::string& name, const Counter& counter) {
+        const Counter* c = &counter;
+        metrics_[name] = [c]() noexcept { return c->value(); };
+    }
+
+    void add(const std::string& name, Gauge gauge) {
+        metrics_[name] = std::move(gauge);
+    }
+
+    // Current value of a registered metric, 0 if there is none by that name
+    uint64_t value(const std::string& name) const {
+        auto it = metrics_.find(name);
+        return it == metrics_.end() ? 0 : it->second();
+    }
+
+    // Writes via a temporary file and rename so readers never see a partial dump
+    bool writeJson(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp);
+            if (!out.is_open()) {
+                return false;
+            }
+
+            auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            out << "{\"timestamp_us\": " << now << ", \"metrics\": {";
+            bool first = true;
+            for (const auto& [name, read] : metrics_) {
+                out << (first ? "\n  " : ",\n  ") << "\"" << name << "\": " << read();
+                first = false;
+            }
+            out << "\n}}\n";
+        }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    std::map<std::string, Gauge> metrics_;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Capture of everything that drives one process' protocol stack: every
+// datagram handed to PerfectLink::receive, plus the local FIFO broadcasts
+// and LA proposals, so that da_replay can rebuild the same stack state and
+// feed it the same input without sockets.
+//
+// File layout: 8 byte magic "DACAPT01", u32 process id, u32 host count,
+// u8 stack (0 FIFO, 1 LA), u8 URB mode, u16 zero, u32 URB fanout, then
+// records of varint microseconds since the previous record, u8 kind,
+// varint id (sender, or slot for proposals), varint size and the bytes.
+// Header fields are in host byte order.
+class PacketCapture {
+public:
+    enum class Kind : uint8_t {
+        Datagram,  // id = sender, bytes = datagram
+        Broadcast, // bytes = FIFO payload
+        Propose,   // id = slot, bytes = space separated values
+    };
+
+    struct Header {
+        uint32_t processId = 0;
+        uint32_t hosts = 0;
+        uint8_t latticeAgreement = 0;
+        uint8_t urbMode = 0;
+        uint32_t urbFanout = 0;
+    };
+
+    struct Record {
+        Kind kind;
+        uint64_t timeUs; // since the first record
+        uint64_t id;
+        std::string_view data;
+    };
+
+    static constexpr size_t kHeaderBytes = 24;
+
+    ~PacketCapture() {
+        flush();
+        if (file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    bool open(const std::string& path, const Header& header) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        char raw[kHeaderBytes] = {};
+        std::memcpy(raw, "DACAPT01", 8);
+        std::memcpy(raw + 8, &header.processId, 4);
+        std::memcpy(raw + 12, &header.hosts, 4);
+        raw[16] = static_cast<char>(header.latticeAgreement);
+        raw[17] = static_cast<char>(header.urbMode);
+        std::memcpy(raw + 20, &header.urbFanout, 4);
+        std::fwrite(raw, 1, sizeof(raw), file_);
+        buffer_.reserve(kFlushBytes + 64 * 1024);
+        return true;
+    }
+
+    bool enabled() const { return file_ != nullptr; }
+
+    void datagram(unsigned long from, const char* data, size_t size) { append(Kind::Datagram, from, data, size); }
+
+    void broadcast(std::string_view payload) { append(Kind::Broadcast, 0, payload.data(), payload.size()); }
+
+    void propose(int slot, const std::set<int>& values) {
+        std::string text;
+        for (int v : values) {
+            if (!text.empty()) {
+                text += ' ';
+            }
+            text += std::to_string(v);
+        }
+        append(Kind::Propose, static_cast<uint64_t>(slot), text.data(), text.size());
+    }
+
+    void flush() {
+        if (file_ == nullptr || buffer_.empty()) {
+            return;
+        }
+        std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+        std::fflush(file_);
+        buffer_.clear();
+    }
+
+    // Parses the header of a capture; false if `bytes` is not one
+    static bool readHeader(std::string_view bytes, Header& header) {
+        if (bytes.size() < kHeaderBytes || bytes.substr(0, 8) != "DACAPT01") {
+            return false;
+        }
+        std::memcpy(&header.processId, bytes.data() + 8, 4);
+        std::memcpy(&header.hosts, bytes.data() + 12, 4);
+        header.latticeAgreement = static_cast<uint8_t>(bytes[16]);
+        header.urbMode = static_cast<uint8_t>(bytes[17]);
+        std::memcpy(&header.urbFanout, bytes.data() + 20, 4);
+        return true;
+    }
+
+    // Walks the records after the header. `rest` starts as the whole file
+    // minus kHeaderBytes and `timeUs` at 0; false at the end or on a
+    // truncated record (a capture cut short by a kill).
+    static bool nextRecord(std::string_view& rest, uint64_t& timeUs, Record& record) {
+        uint64_t delta;
+        uint64_t size;
+        if (!readVarint(rest, delta) || rest.empty()) {
+            return false;
+        }
+        record.kind = static_cast<Kind>(rest[0]);
+        rest.remove_prefix(1);
+        if (!readVarint(rest, record.id) || !readVarint(rest, size) || rest.size() < size) {
+            return false;
+        }
+        timeUs += delta;
+        record.timeUs = timeUs;
+        record.data = rest.substr(0, size);
+        rest.remove_prefix(size);
+        return true;
+    }
+
+private:
+    static constexpr size_t kFlushBytes = 1 << 20;
+
+    void append(Kind kind, uint64_t id, const char* data, size_t size) {
+        if (file_ == nullptr) {
+            return;
+        }
+        uint64_t nowUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        if (lastUs_ == 0) {
+            lastUs_ = nowUs;
+        }
+        appendVarint(nowUs - lastUs_);
+        lastUs_ = nowUs;
+        buffer_.push_back(static_cast<char>(kind));
+        appendVarint(id);
+        appendVarint(size);
+        buffer_.insert(buffer_.end(), data, data + size);
+        if (buffer_.size() >= kFlushBytes) {
+            flush();
+        }
+    }
+
+    void appendVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        buffer_.push_back(static_cast<char>(value));
+    }
+
+    static bool readVarint(std::string_view& rest, uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64 && !rest.empty(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(rest[0]);
+            rest.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::FILE* file_ = nullptr;
+    std::vector<char> buffer_;
+    uint64_t lastUs_ = 0;
+};
@@ -1,9 +1,12 @@
 #pragma once
 
-#include <fstream>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <algorithm>
@@ -19,17 +22,21 @@
 #include <cstring>
 #include <unistd.h>
 
+#include "mapped_file.hpp"
+
 class Parser {
 public:
   struct Host {
     Host() {}
-    Host(size_t id, std::string &ip_or_hostname, unsigned short port)
+    Host(size_t id, const std::string &ip_or_hostname, unsigned short port)
         : id{id}, port{htons(port)} {
 
-      if (isValidIpAddress(ip_or_hostname.c_str())) {
-        ip = inet_addr(ip_or_hostname.c_str());
+      // Numeric addresses never go through the resolver.
+      struct in_addr addr;
+      if (inet_pton(AF_INET, ip_or_hostname.c_str(), &addr) == 1) {
+        ip = addr.s_addr;
       } else {
-        ip = ipLookup(ip_or_hostname.c_str());
+        ip = ipLookupCached(ip_or_hostname);
       }
     }
 
@@ -46,10 +53,18 @@ public:
     unsigned short port;
 
   private:
-    bool isValidIpAddress(const char *ipAddress) {
-      struct sockaddr_in sa;
-      int result = inet_pton(AF_INET, ipAddress, &(sa.sin_addr));
-      return result != 0;
+    // Hosts files usually repeat the same hostname for every process, so
+    // each distinct name is resolved only once.
+    in_addr_t ipLookupCached(const std::string &host) {
+      static std::unordered_map<std::string, in_addr_t> cache;
+      auto it = cache.find(host);
+      if (it != cache.end()) {
+        return it->second;
+      }
+
+      in_addr_t resolved = ipLookup(host.c_str());
+      cache.emplace(host, resolved);
+      return resolved;
     }
 
     in_addr_t ipLookup(const char *host) {
@@ -58,7 +73,7 @@ public:
       void *ptr;
 
       memset(&hints, 0, sizeof(hints));
-      hints.ai_family = PF_UNSPEC;
+      hints.ai_family = AF_INET;
       hints.ai_socktype = SOCK_STREAM;
       hints.ai_flags |= AI_CANONNAME;
 
@@ -68,25 +83,23 @@ public:
             "` to IP: " + std::string(std::strerror(errno)));
       }
 
-      while (res) {
-        inet_ntop(res->ai_family, res->ai_addr->sa_data, addrstr, 128);
-
-        switch (res->ai_family) {
+      for (struct addrinfo *cur = res; cur; cur = cur->ai_next) {
+        switch (cur->ai_family) {
         case AF_INET:
           ptr =
-              &(reinterpret_cast<struct sockaddr_in *>(res->ai_addr))->sin_addr;
-          inet_ntop(res->ai_family, ptr, addrstr, 128);
+              &(reinterpret_cast<struct sockaddr_in *>(cur->ai_addr))->sin_addr;
+          inet_ntop(cur->ai_family, ptr, addrstr, 128);
+          freeaddrinfo(res);
           return inet_addr(addrstr);
-          break;
         // case AF_INET6:
         //     ptr = &((struct sockaddr_in6 *) res->ai_addr)->sin6_addr;
         //     break;
         default:
           break;
         }
-        res = res->ai_next;
       }
 
+      freeaddrinfo(res);
       throw std::runtime_error("No host resolves to IPv4");
     }
   };
@@ -118,6 +131,19 @@ public:
     return outputPath_.c_str();
   }
 
+  bool hasOption(const std::string &name) const {
+    checkParsed();
+    return options_.count(name) > 0;
+  }
+
+  // Value of `--name`, or `fallback` when it was not given
+  std::string option(const std::string &name,
+                     const std::string &fallback = "") const {
+    checkParsed();
+    auto it = options_.find(name);
+    return it == options_.end() ? fallback : it->second;
+  }
+
   const char *configPath() const {
     checkParsed();
     if (!withConfig) {
@@ -128,38 +154,33 @@ public:
   }
 
   std::vector<Host> hosts() {
-    std::ifstream hostsFile(hostsPath());
+    MappedFile hostsFile(hostsPath());
     std::vector<Host> hosts;
 
-    if (!hostsFile.is_open()) {
-      std::ostringstream os;
-      os << "`" << hostsPath() << "` does not exist.";
-      throw std::invalid_argument(os.str());
-    }
-
-    std::string line;
+    std::string_view rest = hostsFile.view();
+    std::string_view line;
     int lineNum = 0;
-    while (std::getline(hostsFile, line)) {
+    while (MappedFile::nextLine(rest, line)) {
       lineNum += 1;
 
-      std::istringstream iss(line);
-
-      trim(line);
+      MappedFile::skipSpaces(line);
       if (line.empty()) {
         continue;
       }
 
       unsigned long id;
-      std::string ip;
+      std::string_view ip;
       unsigned short port;
 
-      if (!(iss >> id >> ip >> port)) {
+      if (!MappedFile::nextNumber(line, id) ||
+          (ip = MappedFile::nextToken(line)).empty() ||
+          !MappedFile::nextNumber(line, port)) {
         std::ostringstream os;
         os << "Parsing for `" << hostsPath() << "` failed at line " << lineNum;
         throw std::invalid_argument(os.str());
       }
 
-      hosts.push_back(Host(id, ip, port));
+      hosts.emplace_back(id, std::string(ip), port);
     }
 
     if (hosts.size() < 2UL) {
@@ -185,6 +206,51 @@ public:
     return hosts;
   }
 
+  // Contents of the config file. The first line holds the run parameters;
+  // for lattice agreement (three or more parameters) each of the following
+  // `header[0]` lines is one proposal.
+  struct Config {
+    std::vector<int> header;
+    std::vector<std::set<int>> proposals;
+
+    bool isLatticeAgreement() const { return header.size() >= 3; }
+  };
+
+  Config config() {
+    MappedFile configFile(configPath());
+    if (configFile.empty()) {
+      std::ostringstream os;
+      os << "`" << configPath() << "` is empty";
+      throw std::invalid_argument(os.str());
+    }
+
+    Config config;
+    std::string_view rest = configFile.view();
+    std::string_view line;
+    MappedFile::nextLine(rest, line);
+
+    int val;
+    while (MappedFile::nextNumber(line, val)) {
+      config.header.push_back(val);
+    }
+
+    if (!config.isLatticeAgreement()) {
+      return config;
+    }
+
+    int numProposals = config.header[0];
+    config.proposals.reserve(static_cast<size_t>(std::max(numProposals, 0)));
+    for (int i = 0; i < numProposals && MappedFile::nextLine(rest, line); ++i) {
+      std::set<int> proposal;
+      while (MappedFile::nextNumber(line, val)) {
+        proposal.insert(val);
+      }
+      config.proposals.push_back(std::move(proposal));
+    }
+
+    return config;
+  }
+
 private:
   bool parseInternal() {
     if (!parseID()) {
@@ -203,6 +269,10 @@ private:
       return false;
     }
 
+    if (!parseOptions()) {
+      return false;
+    }
+
     return true;
   }
 
@@ -212,9 +282,9 @@ private:
               << " --id ID --hosts HOSTS --output OUTPUT";
 
     if (!withConfig) {
-      std::cerr << "\n";
+      std::cerr << " [--OPTION VALUE ...]\n";
     } else {
-      std::cerr << " CONFIG\n";
+      std::cerr << " CONFIG [--OPTION VALUE ...]\n";
     }
 
     exit(EXIT_FAILURE);
@@ -281,6 +351,18 @@ private:
     return true;
   }
 
+  // Optional `--name value` pairs after the positional arguments
+  bool parseOptions() {
+    int first = withConfig ? 8 : 7;
+    for (int i = first; i < argc; i += 2) {
+      if (std::strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+        return false;
+      }
+      options_[std::string(argv[i] + 2)] = std::string(argv[i + 1]);
+    }
+    return true;
+  }
+
   bool isPositiveNumber(const std::string &s) const {
     return !s.empty() && std::find_if(s.begin(), s.end(), [](unsigned char c) {
                            return !std::isdigit(c);
@@ -293,23 +375,6 @@ private:
     }
   }
 
-  void ltrim(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                    [](int ch) { return !std::isspace(ch); }));
-  }
-
-  void rtrim(std::string &s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(),
-                         [](int ch) { return !std::isspace(ch); })
-                .base(),
-            s.end());
-  }
-
-  void trim(std::string &s) {
-    ltrim(s);
-    rtrim(s);
-  }
-
 private:
   const int argc;
   char const *const *argv;
@@ -321,4 +386,5 @@ private:
   std::string hostsPath_;
   std::string outputPath_;
   std::string configPath_;
+  std::map<std::string, std::string> options_;
 };
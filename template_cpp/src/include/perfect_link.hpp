@@ -1,130 +1,616 @@
 #pragma once
 
-#include <functional>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <map>
 #include <set>
 #include <vector>
 #include <string>
 #include <chrono>
-#include <netinet/in.h>
-#include <cstring>
-#include <arpa/inet.h>
 #include "message.hpp"
-#include "parser.hpp"
+#include "transport.hpp"
+#include "metrics.hpp"
+#include "pool_allocator.hpp"
+#include "trace.hpp"
 
+// Perfect link with a failure detector: peers that stay silent while we
+// have unacknowledged messages for them are suspected. Suspected peers are
+// not retransmitted to; they get a single heartbeat probe with exponential
+// backoff instead, and full-rate retransmission resumes as soon as any
+// packet from them arrives.
+//
+// Sending is congestion controlled per peer with AIMD: at most `cwnd`
+// messages are in flight, the window grows by one per ACK in slow start and
+// by one per window afterwards, and it is halved (at most once per
+// retransmission timeout) when a message times out. Messages beyond the
+// window wait at the end of the peer's pending list and go out as ACKs
+// free room.
+//
+// Deliveries go to `Upper::plDeliver(from, msg)`, resolved at compile time
+// (see protocol_stack.hpp for how the layers are composed).
+template <typename Upper>
 class PerfectLink {
 public:
-    using DeliverCallback = std::function<void(unsigned long from, const Message& msg)>;
-
-    PerfectLink(unsigned long myId, int sockfd, const std::vector<Parser::Host>& hosts, DeliverCallback callback)
-        : myId_(myId), sockfd_(sockfd), hosts_(hosts), callback_(callback) {}
+    PerfectLink(unsigned long myId, Transport& transport, Upper& upper)
+        : myId_(myId), transport_(transport), upper_(upper) {}
     
     // Send a message to a specific process
     void send(unsigned long targetId, const Message& msg) {
-        PendingMessage pm;
-        pm.msg = msg;
-        pm.targetId = targetId;
-        pm.lastSendTime = std::chrono::steady_clock::now();
-        pm.acked = false;
+        if (msg.payload.size() > kFragmentBytes) {
+            sendFragmented(targetId, msg);
+        } else {
+            enqueue(targetId, msg);
+        }
+    }
 
-        // Add to pending list
-        pendingMessages_[targetId].push_back(pm);
+    // Handle incoming packet from the process `fromId`
+    void receive(const std::string& data, unsigned long fromId) {
+        stats_.packetsReceived.add();
+        stats_.bytesReceived.add(data.size());
 
-        // Send immediately
-        sendUdp(targetId, msg);
-    }
-    
-    // Handle incoming UDP packet
-    void receive(const std::string& data, const struct sockaddr_in& sender_addr) {
-        Message msg;
+        // Reuse the receive buffer so payloads keep their capacity
+        Message& msg = rxMessage_;
         if (!Message::deserialize(data, msg)) {
+            stats_.malformedDropped.add();
+            return;
+        }
+
+        // Drop packets whose claimed sender does not match the source
+        if (msg.sender_id != fromId) {
+            stats_.malformedDropped.add();
             return;
         }
 
-        if (msg.type == MessageType::PL_ACK) {
-            // Handle ACK
-            auto& pending = pendingMessages_[msg.sender_id];
-            for (auto it = pending.begin(); it != pending.end(); ) {
-                if (it->msg.seq_no == msg.seq_no && it->msg.original_sender_id == msg.original_sender_id && it->msg.original_seq_no == msg.original_seq_no) {
+        // Any packet proves the peer is alive
+        Peer& peer = peers_[fromId];
+        peer.lastHeard = transport_.now();
+        if (peer.suspected) {
+            peer.suspected = false;
+            peer.probeBackoff = kRetransmitTimeout;
+        }
+
+        if (msg.type == MessageType::PL_HEARTBEAT) {
+            // Answer probes with an ACK that matches no pending message
+            Message ack;
+            ack.type = MessageType::PL_ACK;
+            ack.sender_id = static_cast<uint32_t>(myId_);
+            ack.seq_no = 0;
+            ack.original_sender_id = 0;
+            ack.original_seq_no = 0;
+            sendPacket(fromId, ack);
+        } else if (msg.type == MessageType::PL_ACK || msg.type == MessageType::PL_FRAGMENT_ACK) {
+            // Handle ACK; fragments have their own sequence numbers and ACK type
+            stats_.acksReceived.add();
+            DA_TRACE_EVENT(Ack, msg.sender_id, msg.seq_no, 0);
+            bool fragmentAck = msg.type == MessageType::PL_FRAGMENT_ACK;
+            auto& pending = peer.pending;
+            // Only transmitted messages can be acknowledged
+            for (auto it = pending.begin(); it != pending.end() - static_cast<std::ptrdiff_t>(peer.unsent); ) {
+                if (it->msg.seq_no == msg.seq_no && it->msg.original_sender_id == msg.original_sender_id && it->msg.original_seq_no == msg.original_seq_no &&
+                    (it->msg.type == MessageType::PL_FRAGMENT) == fragmentAck) {
+                    onAck(peer, it->msg);
                     it = pending.erase(it); // Remove acknowledged message
                 } else {
                     ++it;
                 }
             }
+            sendBacklog(fromId, peer);
+        } else if (msg.type == MessageType::PL_FRAGMENT) {
+            receiveFragment(fromId, msg);
         } else {
             // Handle Data Message
+            DA_TRACE_EVENT(Receive, msg.sender_id, msg.seq_no, static_cast<uint64_t>(msg.type));
             
             // Send ACK immediately
             Message ack;
             ack.type = MessageType::PL_ACK;
-            ack.sender_id = myId_;
+            ack.sender_id = static_cast<uint32_t>(myId_);
             ack.seq_no = msg.seq_no;
             ack.original_sender_id = msg.original_sender_id;
             ack.original_seq_no = msg.original_seq_no;
             ack.payload = "";
             
-            sendUdp(msg.sender_id, ack);
+            sendPacket(msg.sender_id, ack);
+            stats_.acksSent.add();
 
-            // Deduplicate
-            auto key = std::make_pair(msg.sender_id, msg.seq_no);
-            if (delivered_.find(key) == delivered_.end()) {
-                delivered_.insert(key);
-                callback_(msg.sender_id, msg);
-            }
+            deliverData(msg);
         }
     }
     
-    // Periodic update for retransmissions
+    // Periodic update for retransmissions. Outbound traffic has three
+    // priority classes: ACKs and probes, then fresh messages, both sent as
+    // soon as they arise, then retransmissions, sent only from here and
+    // paced by a token bucket. A retransmission burst after a stall is
+    // spread over several calls instead of queueing in front of the ACKs
+    // and replies other processes are waiting for.
     void update() {
-        auto now = std::chrono::steady_clock::now();
-        for (auto& [targetId, messages] : pendingMessages_) {
-            for (auto& pm : messages) {
-                if (std::chrono::duration_cast<std::chrono::milliseconds>(now - pm.lastSendTime).count() > 100) { // 100ms timeout
-                    sendUdp(targetId, pm.msg);
-                    pm.lastSendTime = now;
-                }
+        auto now = transport_.now();
+        refillRetransmitTokens(now);
+
+        // Start where the budget last ran out, so one peer's backlog cannot
+        // take it every time
+        auto first = peers_.lower_bound(retransmitCursor_);
+        bool exhausted = false;
+        for (auto it = first; it != peers_.end(); ++it) {
+            updatePeer(it->first, it->second, now, exhausted);
+        }
+        for (auto it = peers_.begin(); it != first; ++it) {
+            updatePeer(it->first, it->second, now, exhausted);
+        }
+        if (!exhausted) {
+            retransmitCursor_ = first == peers_.end() ? 0 : first->first + 1;
+        }
+    }
+
+    Transport::Clock::time_point now() const { return transport_.now(); }
+
+    // Whether the failure detector currently suspects process `id`
+    bool suspects(unsigned long id) const {
+        const Peer* peer = findPeer(id);
+        return peer != nullptr && peer->suspected;
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("pl.packets_sent", stats_.packetsSent);
+        registry.add("pl.bytes_sent", stats_.bytesSent);
+        registry.add("pl.packets_received", stats_.packetsReceived);
+        registry.add("pl.bytes_received", stats_.bytesReceived);
+        registry.add("pl.acks_sent", stats_.acksSent);
+        registry.add("pl.acks_received", stats_.acksReceived);
+        registry.add("pl.retransmissions", stats_.retransmissions);
+        registry.add("pl.retransmit_throttled", stats_.retransmitThrottled);
+        registry.add("pl.window_deferred", stats_.windowDeferred);
+        registry.add("pl.window_decreases", stats_.windowDecreases);
+        registry.add("pl.delivered", stats_.delivered);
+        registry.add("pl.duplicates_dropped", stats_.duplicatesDropped);
+        registry.add("pl.malformed_dropped", stats_.malformedDropped);
+        registry.add("pl.suspicions", stats_.suspicions);
+        registry.add("pl.probes_sent", stats_.probesSent);
+        registry.add("pl.messages_fragmented", stats_.messagesFragmented);
+        registry.add("pl.fragments_sent", stats_.fragmentsSent);
+        registry.add("pl.fragments_received", stats_.fragmentsReceived);
+        registry.add("pl.messages_reassembled", stats_.messagesReassembled);
+        registry.add("pl.reassemblies_pending", [this]() noexcept {
+            return static_cast<uint64_t>(reassembly_.size());
+        });
+        registry.add("pl.pending_messages", [this]() noexcept {
+            uint64_t total = 0;
+            for (const auto& [targetId, peer] : peers_) {
+                total += peer.pending.size();
+            }
+            return total;
+        });
+        registry.add("pl.suspected_peers", [this]() noexcept {
+            uint64_t suspected = 0;
+            for (const auto& [targetId, peer] : peers_) {
+                suspected += peer.suspected ? 1 : 0;
             }
+            return suspected;
+        });
+    }
+
+    // Congestion state of the peers 1..numProcesses as
+    // pl.peer.<id>.{cwnd,backlog,loss_permille,goodput_bytes_per_sec}
+    void registerPeerMetrics(MetricsRegistry& registry, unsigned long numProcesses) const {
+        for (unsigned long id = 1; id <= numProcesses; ++id) {
+            std::string prefix = "pl.peer." + std::to_string(id) + ".";
+            registry.add(prefix + "cwnd", [this, id]() noexcept {
+                const Peer* peer = findPeer(id);
+                return peer == nullptr ? static_cast<uint64_t>(kInitialWindow) : static_cast<uint64_t>(peer->cwnd);
+            });
+            registry.add(prefix + "backlog", [this, id]() noexcept {
+                const Peer* peer = findPeer(id);
+                return peer == nullptr ? 0 : static_cast<uint64_t>(peer->unsent);
+            });
+            registry.add(prefix + "loss_permille", [this, id]() noexcept {
+                const Peer* peer = findPeer(id);
+                return peer == nullptr ? 0 : peer->lossPermille;
+            });
+            registry.add(prefix + "goodput_bytes_per_sec", [this, id]() noexcept {
+                const Peer* peer = findPeer(id);
+                return peer == nullptr ? 0 : peer->goodputBytesPerSec;
+            });
         }
     }
 
 private:
+    struct Stats {
+        Counter packetsSent;
+        Counter bytesSent;
+        Counter packetsReceived;
+        Counter bytesReceived;
+        Counter acksSent;
+        Counter acksReceived;
+        Counter retransmissions;
+        Counter retransmitThrottled; // peers cut short by the pacing budget
+        Counter windowDeferred;      // messages that waited for window room
+        Counter windowDecreases;
+        Counter delivered;
+        Counter duplicatesDropped;
+        Counter malformedDropped;
+        Counter suspicions;
+        Counter probesSent;
+        Counter messagesFragmented;
+        Counter fragmentsSent;
+        Counter fragmentsReceived;
+        Counter messagesReassembled;
+    };
+
+    // Message being reassembled from fragments; `buffer` is the payload's
+    // own storage, filled in place
+    struct Reassembly {
+        Message msg;
+        char* buffer = nullptr;
+        size_t received = 0;
+        size_t count = 0;
+    };
+
     struct PendingMessage {
         Message msg;
         unsigned long targetId;
         std::chrono::steady_clock::time_point lastSendTime;
-        bool acked;
+    };
+
+    static constexpr std::chrono::milliseconds kRetransmitTimeout{100};
+    static constexpr std::chrono::milliseconds kSuspectTimeout{1000};
+    static constexpr std::chrono::milliseconds kMaxProbeBackoff{3200};
+
+    // Congestion window bounds and starting point, in messages
+    static constexpr double kMinWindow = 4;
+    static constexpr double kInitialWindow = 256;
+    static constexpr double kMaxWindow = 4096;
+
+    // Period over which per-peer goodput and loss rate are measured
+    static constexpr std::chrono::seconds kRateInterval{1};
+
+    // Retransmission pacing: sustained rate and largest burst, in packets
+    static constexpr double kRetransmitsPerSecond = 200000;
+    static constexpr double kRetransmitBurst = 2048;
+
+    // Larger payloads are fragmented; with the headers a fragment stays
+    // below the 1472 bytes of UDP payload an Ethernet MTU allows
+    static constexpr size_t kFragmentBytes = 1300;
+
+    // Liveness, congestion state and unacknowledged messages of one
+    // destination. The last `unsent` entries of `pending` wait for room in
+    // the window and have not been transmitted yet.
+    struct Peer {
+        std::vector<PendingMessage> pending;
+        size_t unsent = 0;
+        double cwnd = kInitialWindow;
+        double ssthresh = kMaxWindow;
+        // No decrease yet: the first loss always counts, even right at the
+        // clock's epoch as in simulated runs
+        Transport::Clock::time_point lastDecrease = Transport::Clock::time_point::min();
+
+        // Current measurement interval and the last completed one
+        Transport::Clock::time_point intervalStart;
+        uint64_t intervalAckedBytes = 0;
+        uint64_t intervalSent = 0;
+        uint64_t intervalRetransmitted = 0;
+        uint64_t goodputBytesPerSec = 0;
+        uint64_t lossPermille = 0;
+
+        Transport::Clock::time_point lastHeard;
+        Transport::Clock::time_point busySince; // pending became non-empty
+        bool suspected = false;
+        Transport::Clock::time_point nextProbe;
+        Transport::Clock::duration probeBackoff = kRetransmitTimeout;
     };
 
     unsigned long myId_;
-    int sockfd_;
-    std::vector<Parser::Host> hosts_;
-    DeliverCallback callback_;
+    Transport& transport_;
+    Upper& upper_;
     
-    // Map of targetId -> list of pending messages
-    std::map<unsigned long, std::vector<PendingMessage>> pendingMessages_;
+    // Map of targetId -> peer state and pending messages
+    std::map<unsigned long, Peer> peers_;
     
     // Set of delivered messages (senderId, seqNo) for deduplication
-    std::set<std::pair<unsigned long, unsigned long>> delivered_;
-
-    struct sockaddr_in getAddr(unsigned long targetId) {
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        
-        for (const auto& host : hosts_) {
-            if (host.id == targetId) {
-                addr.sin_addr.s_addr = host.ip;
-                addr.sin_port = host.port;
+    PoolSet<std::pair<unsigned long, unsigned long>> delivered_;
+
+    Stats stats_;
+
+    // Retransmission token bucket, and the peer to start the next round at
+    double retransmitTokens_ = kRetransmitBurst;
+    Transport::Clock::time_point lastRefill_;
+    unsigned long retransmitCursor_ = 0;
+
+    // Fragmentation: our fragment sequence numbers, fragments seen per
+    // (sender, fragment seq) and messages being reassembled keyed by
+    // (sender, seq of their first fragment)
+    uint64_t fragmentSeq_ = 0;
+    PoolSet<std::pair<unsigned long, unsigned long>> fragmentsSeen_;
+    PoolMap<std::pair<unsigned long, unsigned long>, Reassembly> reassembly_;
+
+    // Transient buffers, reused across packets
+    Message rxMessage_;
+    std::string txBuffer_;
+    std::string fragmentBuffer_;
+
+    void sendPacket(unsigned long targetId, const Message& msg) {
+        msg.serializeTo(txBuffer_);
+        stats_.packetsSent.add();
+        stats_.bytesSent.add(txBuffer_.size());
+        transport_.send(targetId, txBuffer_);
+    }
+
+    const Peer* findPeer(unsigned long id) const noexcept {
+        auto it = peers_.find(id);
+        return it == peers_.end() ? nullptr : &it->second;
+    }
+
+    void refillRetransmitTokens(Transport::Clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+        retransmitTokens_ = std::min(kRetransmitBurst, retransmitTokens_ + elapsed * kRetransmitsPerSecond);
+        lastRefill_ = now;
+    }
+
+    // Failure detection and due retransmissions of one peer; sets
+    // `exhausted` and the cursor when the token bucket runs dry
+    void updatePeer(unsigned long targetId, Peer& peer, Transport::Clock::time_point now, bool& exhausted) {
+        sampleRates(peer, now);
+        if (peer.pending.empty()) {
+            return;
+        }
+
+        // Silent for too long while we wait on it: suspect the peer
+        auto silentSince = std::max(peer.lastHeard, peer.busySince);
+        if (!peer.suspected && now - silentSince > kSuspectTimeout) {
+            peer.suspected = true;
+            peer.nextProbe = now;
+            stats_.suspicions.add();
+        }
+
+        if (peer.suspected) {
+            if (now >= peer.nextProbe) {
+                sendProbe(targetId);
+                peer.nextProbe = now + peer.probeBackoff;
+                peer.probeBackoff = std::min<Transport::Clock::duration>(peer.probeBackoff * 2, kMaxProbeBackoff);
+            }
+            return;
+        }
+
+        sendBacklog(targetId, peer);
+
+        auto sentEnd = peer.pending.end() - static_cast<std::ptrdiff_t>(peer.unsent);
+        for (auto it = peer.pending.begin(); it != sentEnd; ++it) {
+            PendingMessage& pm = *it;
+            if (now - pm.lastSendTime <= kRetransmitTimeout) {
+                continue;
+            }
+            if (retransmitTokens_ < 1) {
+                // The rest stays due and goes out in a later round
+                stats_.retransmitThrottled.add();
+                if (!exhausted) {
+                    exhausted = true;
+                    retransmitCursor_ = targetId;
+                }
                 break;
             }
+            retransmitTokens_ -= 1;
+            onLoss(peer, now);
+            DA_TRACE_EVENT(Retransmit, targetId, pm.msg.seq_no, static_cast<uint64_t>(pm.msg.type));
+            sendPacket(targetId, pm.msg);
+            stats_.retransmissions.add();
+            peer.intervalSent++;
+            peer.intervalRetransmitted++;
+            pm.lastSendTime = now;
+        }
+    }
+
+    // Congestion window: slow start below ssthresh, then one message per
+    // window; goodput counts acknowledged payload bytes
+    void onAck(Peer& peer, const Message& acked) {
+        if (peer.cwnd < peer.ssthresh) {
+            peer.cwnd += 1;
+        } else {
+            peer.cwnd += 1 / peer.cwnd;
+        }
+        peer.cwnd = std::min(peer.cwnd, kMaxWindow);
+        peer.intervalAckedBytes += acked.payload.size();
+    }
+
+    // A timeout halves the window; timeouts of the same round count once
+    void onLoss(Peer& peer, Transport::Clock::time_point now) {
+        if (now <= peer.lastDecrease + kRetransmitTimeout) {
+            return;
+        }
+        peer.ssthresh = std::max(peer.cwnd / 2, kMinWindow);
+        peer.cwnd = peer.ssthresh;
+        peer.lastDecrease = now;
+        stats_.windowDecreases.add();
+    }
+
+    // Sends waiting messages while the window has room
+    void sendBacklog(unsigned long targetId, Peer& peer) {
+        auto now = transport_.now();
+        while (peer.unsent > 0 && inFlight(peer) < peer.cwnd) {
+            PendingMessage& pm = peer.pending[peer.pending.size() - peer.unsent];
+            --peer.unsent;
+            transmit(targetId, peer, pm, now);
+        }
+    }
+
+    static double inFlight(const Peer& peer) { return static_cast<double>(peer.pending.size() - peer.unsent); }
+
+    // First transmission of a pending message
+    void transmit(unsigned long targetId, Peer& peer, PendingMessage& pm, Transport::Clock::time_point now) {
+        pm.lastSendTime = now;
+        peer.intervalSent++;
+        DA_TRACE_EVENT(Send, targetId, pm.msg.seq_no, static_cast<uint64_t>(pm.msg.type));
+        sendPacket(targetId, pm.msg);
+    }
+
+    // Per-peer goodput and loss rate over the last kRateInterval
+    static void sampleRates(Peer& peer, Transport::Clock::time_point now) {
+        auto elapsed = now - peer.intervalStart;
+        if (elapsed < kRateInterval) {
+            return;
+        }
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        peer.goodputBytesPerSec = static_cast<uint64_t>(static_cast<double>(peer.intervalAckedBytes) / seconds);
+        peer.lossPermille = peer.intervalSent == 0 ? 0 : peer.intervalRetransmitted * 1000 / peer.intervalSent;
+        peer.intervalAckedBytes = 0;
+        peer.intervalSent = 0;
+        peer.intervalRetransmitted = 0;
+        peer.intervalStart = now;
+    }
+
+    void enqueue(unsigned long targetId, const Message& msg) {
+        PendingMessage pm;
+        pm.msg = msg;
+        pm.targetId = targetId;
+
+        // Add to pending list
+        auto now = transport_.now();
+        Peer& peer = peers_[targetId];
+        if (peer.pending.empty()) {
+            peer.busySince = now;
+        }
+        peer.pending.push_back(pm);
+
+        // Send immediately if the window allows, otherwise after the
+        // messages already waiting
+        if (peer.unsent == 0 && inFlight(peer) < peer.cwnd) {
+            transmit(targetId, peer, peer.pending.back(), now);
+        } else {
+            peer.unsent++;
+            stats_.windowDeferred.add();
+        }
+    }
+
+    void deliverData(const Message& msg) {
+        // Deduplicate
+        auto key = std::make_pair(static_cast<unsigned long>(msg.sender_id), msg.seq_no);
+        if (delivered_.insert(key).second) {
+            stats_.delivered.add();
+            upper_.plDeliver(msg.sender_id, msg);
+        } else {
+            stats_.duplicatesDropped.add();
+        }
+    }
+
+    // Splits `msg` into PL_FRAGMENT packets that are acknowledged and
+    // retransmitted on their own. Fragment i of n has PL seq base + i from
+    // our fragment sequence, original_sender_id i and original_seq_no n; its
+    // payload is "TYPE SEQ ORIG_SENDER ORIG_SEQ TOTAL_BYTES " of the inner
+    // message followed by the bytes at i * kFragmentBytes.
+    void sendFragmented(unsigned long targetId, const Message& msg) {
+        std::string_view payload = msg.payload.view();
+        size_t count = (payload.size() + kFragmentBytes - 1) / kFragmentBytes;
+        uint64_t base = fragmentSeq_ + 1;
+        fragmentSeq_ += count;
+
+        std::string prefix = std::to_string(static_cast<int>(msg.type)) + " " + std::to_string(msg.seq_no) + " " +
+                             std::to_string(msg.original_sender_id) + " " + std::to_string(msg.original_seq_no) + " " +
+                             std::to_string(payload.size()) + " ";
+
+        Message fragment;
+        fragment.type = MessageType::PL_FRAGMENT;
+        fragment.sender_id = msg.sender_id;
+        fragment.original_seq_no = static_cast<uint32_t>(count);
+        for (size_t i = 0; i < count; ++i) {
+            fragmentBuffer_ = prefix;
+            fragmentBuffer_.append(payload.substr(i * kFragmentBytes, kFragmentBytes));
+            fragment.seq_no = base + i;
+            fragment.original_sender_id = static_cast<uint32_t>(i);
+            fragment.payload = fragmentBuffer_;
+            enqueue(targetId, fragment);
+        }
+        stats_.messagesFragmented.add();
+        stats_.fragmentsSent.add(count);
+    }
+
+    void receiveFragment(unsigned long fromId, const Message& fragment) {
+        Message ack;
+        ack.type = MessageType::PL_FRAGMENT_ACK;
+        ack.sender_id = static_cast<uint32_t>(myId_);
+        ack.seq_no = fragment.seq_no;
+        ack.original_sender_id = fragment.original_sender_id;
+        ack.original_seq_no = fragment.original_seq_no;
+        sendPacket(fromId, ack);
+        stats_.acksSent.add();
+        stats_.fragmentsReceived.add();
+
+        if (!fragmentsSeen_.insert({fromId, fragment.seq_no}).second) {
+            stats_.duplicatesDropped.add();
+            return;
+        }
+
+        size_t index = fragment.original_sender_id;
+        size_t count = fragment.original_seq_no;
+        const char* p = fragment.payload.data();
+        const char* end = p + fragment.payload.size();
+        int type;
+        uint64_t seq;
+        uint32_t originalSender;
+        uint32_t originalSeq;
+        size_t total;
+        if (index >= count || fragment.seq_no < index ||
+            !parseNumber(p, end, type) || !parseNumber(p, end, seq) || !parseNumber(p, end, originalSender) ||
+            !parseNumber(p, end, originalSeq) || !parseNumber(p, end, total) || p == end) {
+            stats_.malformedDropped.add();
+            return;
+        }
+        ++p; // separator
+        size_t chunk = static_cast<size_t>(end - p);
+        size_t offset = index * kFragmentBytes;
+        if (offset + chunk > total || (index + 1 < count && chunk != kFragmentBytes)) {
+            stats_.malformedDropped.add();
+            return;
+        }
+
+        auto key = std::make_pair(fromId, static_cast<unsigned long>(fragment.seq_no - index));
+        Reassembly& r = reassembly_[key];
+        if (r.count == 0) {
+            r.msg.type = static_cast<MessageType>(type);
+            r.msg.sender_id = static_cast<uint32_t>(fromId);
+            r.msg.seq_no = seq;
+            r.msg.original_sender_id = originalSender;
+            r.msg.original_seq_no = originalSeq;
+            r.buffer = r.msg.payload.resize(total);
+            r.count = count;
+        } else if (total != r.msg.payload.size() || count != r.count || static_cast<MessageType>(type) != r.msg.type ||
+                   seq != r.msg.seq_no || originalSender != r.msg.original_sender_id ||
+                   originalSeq != r.msg.original_seq_no) {
+            // The buffer was sized from the first fragment seen; later ones
+            // must describe the same message
+            stats_.malformedDropped.add();
+            return;
+        }
+        std::memcpy(r.buffer + offset, p, chunk);
+
+        if (++r.received == r.count) {
+            Message msg = std::move(r.msg);
+            reassembly_.erase(key);
+            stats_.messagesReassembled.add();
+            DA_TRACE_EVENT(Receive, msg.sender_id, msg.seq_no, static_cast<uint64_t>(msg.type));
+            deliverData(msg);
+        }
+    }
+
+    template <typename T>
+    static bool parseNumber(const char*& p, const char* end, T& value) {
+        while (p < end && *p == ' ') {
+            ++p;
+        }
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            return false;
         }
-        return addr;
+        p = result.ptr;
+        return true;
     }
 
-    void sendUdp(unsigned long targetId, const Message& msg) {
-        std::string data = msg.serialize();
-        struct sockaddr_in addr = getAddr(targetId);
-        
-        sendto(sockfd_, data.c_str(), data.size(), 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    void sendProbe(unsigned long targetId) {
+        Message probe;
+        probe.type = MessageType::PL_HEARTBEAT;
+        probe.sender_id = static_cast<uint32_t>(myId_);
+        probe.seq_no = 0;
+        probe.original_sender_id = 0;
+        probe.original_seq_no = 0;
+        sendPacket(targetId, probe);
+        stats_.probesSent.add();
     }
 };
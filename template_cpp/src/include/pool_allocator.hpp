@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <new>
+#include <set>
+#include <utility>
+
+#include "metrics.hpp"
+
+// Slab allocation for the node-based containers of the protocol layers.
+// Nodes of one size class come from 64 KiB slabs carved into a free list;
+// freed nodes go back to the list and slabs are never returned, so once the
+// working set has been reached the map/set churn of the message path no
+// longer touches the global heap. Free lists are per thread and lock free.
+class NodePoolStats {
+public:
+    static Counter& slabBytes() {
+        static Counter bytes;
+        return bytes;
+    }
+
+    static void registerMetrics(MetricsRegistry& registry) {
+        registry.add("pool.slab_bytes", slabBytes());
+    }
+};
+
+template <size_t Size, size_t Align>
+class NodePool {
+public:
+    static void* allocate() {
+        FreeList& list = local();
+        if (list.head == nullptr) {
+            refill(list);
+        }
+        Node* node = list.head;
+        list.head = node->next;
+        return node;
+    }
+
+    static void deallocate(void* p) {
+        FreeList& list = local();
+        Node* node = static_cast<Node*>(p);
+        node->next = list.head;
+        list.head = node;
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    struct FreeList {
+        Node* head = nullptr;
+    };
+
+    static constexpr size_t kAlign = Align > alignof(Node) ? Align : alignof(Node);
+    static constexpr size_t kNodeSize = (std::max(Size, sizeof(Node)) + kAlign - 1) / kAlign * kAlign;
+    static constexpr size_t kSlabBytes = 64 * 1024;
+    static constexpr size_t kNodesPerSlab = kSlabBytes / kNodeSize > 0 ? kSlabBytes / kNodeSize : 1;
+
+    static FreeList& local() {
+        thread_local FreeList list;
+        return list;
+    }
+
+    static void refill(FreeList& list) {
+        char* slab = static_cast<char*>(::operator new(kNodesPerSlab * kNodeSize, std::align_val_t(kAlign)));
+        NodePoolStats::slabBytes().add(kNodesPerSlab * kNodeSize);
+        for (size_t i = kNodesPerSlab; i > 0; --i) {
+            Node* node = reinterpret_cast<Node*>(slab + (i - 1) * kNodeSize);
+            node->next = list.head;
+            list.head = node;
+        }
+    }
+};
+
+// Stateless allocator drawing single objects from NodePool. Array requests
+// (vector storage and the like) go to the global heap.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(NodePool<sizeof(T), alignof(T)>::allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (n == 1) {
+            NodePool<sizeof(T), alignof(T)>::deallocate(p);
+        } else {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename K, typename V, typename Compare = std::less<K>>
+using PoolMap = std::map<K, V, Compare, PoolAllocator<std::pair<const K, V>>>;
+
+template <typename K, typename Compare = std::less<K>>
+using PoolSet = std::set<K, Compare, PoolAllocator<K>>;
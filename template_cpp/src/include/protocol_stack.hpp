@@ -0,0 +1,100 @@
+#pragma once
+
+#include "perfect_link.hpp"
+#include "urb.hpp"
+#include "fifo_broadcast.hpp"
+#include "lattice_agreement.hpp"
+
+// Compile-time composition of the protocol layers. Each layer is a template
+// on the layers it calls, so a packet's way from PerfectLink::receive up to
+// the application sink is a chain of direct calls the compiler can inline,
+// without std::function or pointer checks in between.
+//
+// A layer and the one above it call each other (URB sends through PL, PL
+// delivers to URB), so the stack is the upper layer of the perfect link and
+// routes its deliveries by message type. The stack object must not be moved
+// or copied once built: the layers hold references to it and to each other.
+
+// FIFO broadcast: PL -> URB -> FIFO -> Sink::fifoDeliver(from, msg)
+template <typename Sink>
+class FifoStack {
+public:
+    using Link = PerfectLink<FifoStack>;
+    using Urb = UniformReliableBroadcast<Link, FifoStack>;
+    using Fifo = FIFOBroadcast<Urb, Sink>;
+
+    FifoStack(unsigned long myId, Transport& transport, int numProcesses, Sink& sink,
+              UrbMode mode = UrbMode::Relay, unsigned long fanout = kDefaultUrbFanout)
+        : pl(myId, transport, *this), urb(myId, pl, numProcesses, *this, mode, fanout), fifo(myId, urb, sink),
+          numProcesses_(static_cast<unsigned long>(numProcesses)) {}
+
+    FifoStack(const FifoStack&) = delete;
+    FifoStack& operator=(const FifoStack&) = delete;
+
+    void plDeliver(unsigned long from, const Message& msg) {
+        if (Urb::handles(msg.type)) {
+            urb.deliver(from, msg);
+        }
+    }
+
+    void urbDeliver(unsigned long from, const Message& msg) { fifo.deliver(from, msg); }
+
+    // Timers of all layers; call from the event loop
+    void update() {
+        urb.update();
+        pl.update();
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        pl.registerMetrics(registry);
+        pl.registerPeerMetrics(registry, numProcesses_);
+        urb.registerMetrics(registry);
+        fifo.registerMetrics(registry);
+    }
+
+    Link pl;
+    Urb urb;
+    Fifo fifo;
+
+private:
+    unsigned long numProcesses_;
+};
+
+// Lattice agreement: PL -> LA -> Sink::decide(slot, value)
+template <typename Sink>
+class LatticeStack {
+public:
+    using Link = PerfectLink<LatticeStack>;
+    using Agreement = LatticeAgreement<Link, Sink>;
+
+    LatticeStack(unsigned long myId, Transport& transport, int numProcesses, Sink& sink)
+        : pl(myId, transport, *this), la(myId, pl, numProcesses, sink),
+          numProcesses_(static_cast<unsigned long>(numProcesses)) {}
+
+    LatticeStack(const LatticeStack&) = delete;
+    LatticeStack& operator=(const LatticeStack&) = delete;
+
+    void plDeliver(unsigned long from, const Message& msg) {
+        if (Agreement::handles(msg.type)) {
+            la.receive(from, msg);
+        }
+    }
+
+    // Sends queued LA records and runs retransmissions; call from the event loop
+    void update() {
+        la.flush();
+        pl.update();
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        pl.registerMetrics(registry);
+        pl.registerPeerMetrics(registry, numProcesses_);
+        la.registerMetrics(registry);
+    }
+
+    Link pl;
+    Agreement la;
+
+private:
+    unsigned long numProcesses_;
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+#include "parser.hpp"
+#include "transport.hpp"
+
+// Single-producer single-consumer ring of variable-length datagrams, laid
+// out in memory shared by the two processes. Records are a 32-bit length
+// followed by the bytes, padded to 8; a record that would straddle the end
+// of the buffer is preceded by a wrap marker and written at the start.
+class ShmRing {
+public:
+    static constexpr size_t kCapacity = 256 * 1024;
+
+    struct Header {
+        alignas(64) std::atomic<uint64_t> head; // written by the producer
+        alignas(64) std::atomic<uint64_t> tail; // written by the consumer
+    };
+
+    // Header plus buffer, as placed in a segment
+    static constexpr size_t kBytes = sizeof(Header) + kCapacity;
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring indices must be lock free across processes");
+    static_assert((kCapacity & (kCapacity - 1)) == 0, "ring capacity must be a power of two");
+
+    explicit ShmRing(char* base)
+        : header_(reinterpret_cast<Header*>(base)), data_(base + sizeof(Header)) {}
+
+    // Appends one datagram; false if the ring has no room for it
+    bool push(const char* bytes, size_t size) {
+        size_t need = recordBytes(size);
+        if (need > kCapacity / 2) {
+            return false;
+        }
+
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        uint64_t tail = header_->tail.load(std::memory_order_acquire);
+        size_t offset = static_cast<size_t>(head & (kCapacity - 1));
+        size_t toEnd = kCapacity - offset;
+        size_t total = need <= toEnd ? need : toEnd + need;
+        if (head + total - tail > kCapacity) {
+            return false;
+        }
+
+        if (need > toEnd) {
+            std::memcpy(data_ + offset, &kWrap, sizeof(kWrap));
+            head += toEnd;
+            offset = 0;
+        }
+        uint32_t length = static_cast<uint32_t>(size);
+        std::memcpy(data_ + offset, &length, sizeof(length));
+        std::memcpy(data_ + offset + sizeof(length), bytes, size);
+        header_->head.store(head + need, std::memory_order_release);
+        return true;
+    }
+
+    // Hands the oldest datagram to `fn(data, size)` and removes it; false
+    // if the ring is empty. The bytes are only valid during the call.
+    template <typename Fn>
+    bool pop(Fn&& fn) {
+        uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+
+        size_t offset = static_cast<size_t>(tail & (kCapacity - 1));
+        uint32_t length;
+        std::memcpy(&length, data_ + offset, sizeof(length));
+        if (length == kWrap) {
+            tail += kCapacity - offset;
+            offset = 0;
+            std::memcpy(&length, data_, sizeof(length));
+        }
+        fn(data_ + offset + sizeof(length), static_cast<size_t>(length));
+        header_->tail.store(tail + recordBytes(length), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return header_->tail.load(std::memory_order_relaxed) == header_->head.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr uint32_t kWrap = 0xffffffff;
+
+    static size_t recordBytes(size_t size) { return (sizeof(uint32_t) + size + 7) & ~size_t(7); }
+
+    Header* header_;
+    char* data_;
+};
+
+// Transport for processes on the same host: every process owns an inbox
+// segment in /dev/shm with one ring per sender, and peers whose address is
+// loopback or our own are sent to through their inbox instead of the UDP
+// socket. Everything else, and anything that does not fit (peer not up yet,
+// ring full), still goes to the socket transport underneath, so the
+// receiver keeps reading both.
+//
+// The receiver blocks on the UDP socket when it is idle. Before
+// doing so it raises the `sleeping` flag of its inbox; a sender that finds
+// the flag raised after writing clears it and rings the doorbell, an empty
+// UDP datagram. Busy receivers therefore cost no syscalls at all.
+class ShmTransport : public Transport {
+public:
+    ShmTransport(Transport& socket, const std::vector<Parser::Host>& hosts, unsigned long myId)
+        : socket_(socket), myId_(myId), peers_(hosts.size() + 1) {
+        in_addr_t myIp = 0;
+        for (const auto& host : hosts) {
+            if (host.id == myId) {
+                myIp = host.ip;
+            }
+        }
+        for (const auto& host : hosts) {
+            Peer& peer = peers_[host.id];
+            peer.local = host.ip == myIp || (ntohl(host.ip) >> 24) == 127;
+            peer.path = segmentPath(host.port);
+            if (peer.local && host.id != myId) {
+                localPeers_.push_back(host.id);
+            }
+        }
+    }
+
+    ~ShmTransport() {
+        for (unsigned long id = 1; id < peers_.size(); ++id) {
+            if (id != myId_ && peers_[id].segment != nullptr) {
+                munmap(peers_[id].segment, segmentBytes());
+            }
+        }
+        if (inbox_ != nullptr) {
+            munmap(inbox_, segmentBytes());
+            ::unlink(inboxPath().c_str());
+        }
+    }
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    // Size of an inbox, ours included: one ring per process
+    size_t segmentBytes() const { return sizeof(Segment) + (peers_.size() - 1) * ShmRing::kBytes; }
+
+    // Creates our inbox, replacing one left behind by an earlier run. False
+    // if shared memory is unavailable; everything then goes over UDP.
+    bool open() {
+        const std::string& path = inboxPath();
+        ::unlink(path.c_str());
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, static_cast<off_t>(segmentBytes())) < 0) {
+            ::close(fd);
+            ::unlink(path.c_str());
+            return false;
+        }
+        void* addr = mmap(nullptr, segmentBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            ::unlink(path.c_str());
+            return false;
+        }
+
+        inbox_ = static_cast<char*>(addr);
+        Segment* segment = header(inbox_);
+        segment->ownerPid = static_cast<int32_t>(getpid());
+        segment->rings = static_cast<uint32_t>(peers_.size() - 1);
+        segment->ready.store(1, std::memory_order_release);
+        peers_[myId_].segment = inbox_;
+        return true;
+    }
+
+    bool active() const { return inbox_ != nullptr; }
+
+    const std::string& inboxPath() const { return peers_[myId_].path; }
+
+    void send(unsigned long targetId, const std::string& data) override {
+        Peer& peer = peers_[targetId];
+        if (active() && peer.local && (peer.segment != nullptr || attach(peer))) {
+            if (ring(peer.segment, myId_).push(data.data(), data.size())) {
+                stats_.sent.add();
+                ringDoorbell(targetId, peer);
+                return;
+            }
+            stats_.ringFull.add();
+        }
+        socket_.send(targetId, data);
+    }
+
+    // Hands up to `budget` datagrams per sender waiting in our inbox to
+    // `deliver(from, data, size)`; returns how many were handed over
+    template <typename Fn>
+    size_t poll(Fn&& deliver, size_t budget = 64) {
+        if (!active()) {
+            return 0;
+        }
+        size_t received = 0;
+        auto receiveFrom = [&](unsigned long from) {
+            ShmRing r = ring(inbox_, from);
+            for (size_t i = 0; i < budget && r.pop([&](const char* data, size_t size) { deliver(from, data, size); });
+                 ++i) {
+                ++received;
+            }
+        };
+        for (unsigned long from : localPeers_) {
+            receiveFrom(from);
+        }
+        receiveFrom(myId_);
+        stats_.received.add(received);
+        return received;
+    }
+
+    // Announces that we are about to block on the UDP socket, so senders
+    // ring the doorbell. False if datagrams arrived meanwhile and we should
+    // not block; otherwise call endSleep() once awake.
+    bool beginSleep() {
+        if (!active()) {
+            return true;
+        }
+        Segment* segment = header(inbox_);
+        segment->sleeping.store(1, std::memory_order_seq_cst);
+        // StoreLoad barrier, pairing with the fence in ringDoorbell: either
+        // the sender sees the flag or we see its datagram
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ring(inbox_, myId_).empty()) {
+            segment->sleeping.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        for (unsigned long from : localPeers_) {
+            if (!ring(inbox_, from).empty()) {
+                segment->sleeping.store(0, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void endSleep() {
+        if (active()) {
+            header(inbox_)->sleeping.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("shm.sent", stats_.sent);
+        registry.add("shm.received", stats_.received);
+        registry.add("shm.ring_full", stats_.ringFull);
+        registry.add("shm.doorbells", stats_.doorbells);
+    }
+
+private:
+    struct Segment {
+        alignas(64) std::atomic<uint32_t> ready;
+        std::atomic<uint32_t> sleeping;
+        int32_t ownerPid;
+        uint32_t rings;
+    };
+
+    struct Peer {
+        bool local = false;
+        std::string path;
+        char* segment = nullptr; // the peer's inbox, once attached
+        Clock::time_point nextAttach;
+    };
+
+    struct Stats {
+        Counter sent;
+        Counter received;
+        Counter ringFull;
+        Counter doorbells;
+    };
+
+    // Retry interval for peers whose inbox does not exist yet
+    static constexpr std::chrono::milliseconds kAttachRetry{100};
+
+    static std::string segmentPath(in_port_t port) {
+        return "/dev/shm/da_inbox_" + std::to_string(static_cast<unsigned>(ntohs(port)));
+    }
+
+    static Segment* header(char* segment) { return reinterpret_cast<Segment*>(segment); }
+
+    // Ring of `from` inside a segment; rings are indexed by sender id
+    static ShmRing ring(char* segment, unsigned long from) {
+        return ShmRing(segment + sizeof(Segment) + (from - 1) * ShmRing::kBytes);
+    }
+
+    // Maps the inbox of a co-located peer if it is up and owned by a live
+    // process; until then the peer is sent to over UDP
+    bool attach(Peer& peer) {
+        Clock::time_point t = Clock::now();
+        if (t < peer.nextAttach) {
+            return false;
+        }
+        peer.nextAttach = t + kAttachRetry;
+
+        int fd = ::open(peer.path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) != segmentBytes()) {
+            ::close(fd);
+            return false;
+        }
+        void* addr = mmap(nullptr, segmentBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+
+        Segment* segment = header(static_cast<char*>(addr));
+        bool alive = segment->ready.load(std::memory_order_acquire) == 1 &&
+                     segment->rings == peers_.size() - 1 && kill(segment->ownerPid, 0) == 0;
+        if (!alive) {
+            munmap(addr, segmentBytes());
+            return false;
+        }
+        peer.segment = static_cast<char*>(addr);
+        return true;
+    }
+
+    // Wakes the peer if it went to sleep before seeing our datagram
+    void ringDoorbell(unsigned long targetId, Peer& peer) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Segment* segment = header(peer.segment);
+        if (segment->sleeping.load(std::memory_order_relaxed) != 0 &&
+            segment->sleeping.exchange(0, std::memory_order_seq_cst) != 0) {
+            stats_.doorbells.add();
+            socket_.send(targetId, std::string());
+        }
+    }
+
+    Transport& socket_;
+    unsigned long myId_;
+
+    // Indexed by host id
+    std::vector<Peer> peers_;
+
+    // Co-located peers other than us, the senders that can fill our inbox
+    std::vector<unsigned long> localPeers_;
+
+    char* inbox_ = nullptr;
+    Stats stats_;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "transport.hpp"
+
+// Parameters of the simulated network. All times are virtual microseconds.
+struct SimConfig {
+    uint64_t latencyUs = 500;            // one-way propagation delay
+    uint64_t jitterUs = 0;               // uniform extra delay in [0, jitterUs]
+    double lossRate = 0.0;               // probability a datagram is dropped
+    double reorderRate = 0.0;            // probability a datagram is held back
+    uint64_t reorderDelayUs = 5000;      // extra delay of held back datagrams
+    uint64_t bandwidthBytesPerSec = 0;   // per-sender uplink, 0 = unlimited
+    uint64_t seed = 1;
+};
+
+// In-process network driven by a virtual clock. Datagrams are queued with
+// their arrival time and handed to the receiving process by runUntil(), so
+// a run depends only on the configuration and seed.
+class SimNetwork {
+public:
+    using Receiver = std::function<void(unsigned long from, const std::string& data)>;
+
+    struct Stats {
+        uint64_t packetsSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t packetsDropped = 0;
+        uint64_t packetsDelivered = 0;
+    };
+
+    SimNetwork(size_t numProcesses, const SimConfig& config)
+        : config_(config), rng_(config.seed), receivers_(numProcesses + 1),
+          linkFreeAtUs_(numProcesses + 1, 0), nowUs_(0), nextEventSeq_(0) {}
+
+    void attach(unsigned long id, Receiver receiver) {
+        receivers_[id] = std::move(receiver);
+    }
+
+    void send(unsigned long from, unsigned long to, const std::string& data) {
+        stats_.packetsSent++;
+        stats_.bytesSent += data.size();
+
+        // Serialize on the sender's uplink; drops still consume bandwidth
+        uint64_t departUs = nowUs_;
+        if (config_.bandwidthBytesPerSec > 0) {
+            departUs = std::max(departUs, linkFreeAtUs_[from]);
+            departUs += data.size() * 1000000 / config_.bandwidthBytesPerSec;
+            linkFreeAtUs_[from] = departUs;
+        }
+
+        if (config_.lossRate > 0 && uniform_(rng_) < config_.lossRate) {
+            stats_.packetsDropped++;
+            return;
+        }
+
+        uint64_t arriveUs = departUs + config_.latencyUs;
+        if (config_.jitterUs > 0) {
+            arriveUs += rng_() % (config_.jitterUs + 1);
+        }
+        if (config_.reorderRate > 0 && uniform_(rng_) < config_.reorderRate) {
+            arriveUs += config_.reorderDelayUs;
+        }
+
+        queue_.emplace(std::make_pair(arriveUs, nextEventSeq_++), Packet{from, to, data});
+    }
+
+    // Deliver every datagram due up to `untilUs` and advance the clock
+    void runUntil(uint64_t untilUs) {
+        while (!queue_.empty() && queue_.begin()->first.first <= untilUs) {
+            auto node = queue_.extract(queue_.begin());
+            const Packet& packet = node.mapped();
+            nowUs_ = node.key().first;
+            stats_.packetsDelivered++;
+            if (receivers_[packet.to]) {
+                receivers_[packet.to](packet.from, packet.data);
+            }
+        }
+        nowUs_ = std::max(nowUs_, untilUs);
+    }
+
+    uint64_t nowUs() const { return nowUs_; }
+
+    Transport::Clock::time_point now() const {
+        return Transport::Clock::time_point(std::chrono::microseconds(nowUs_));
+    }
+
+    bool idle() const { return queue_.empty(); }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Packet {
+        unsigned long from;
+        unsigned long to;
+        std::string data;
+    };
+
+    SimConfig config_;
+    std::mt19937_64 rng_;
+    std::uniform_real_distribution<double> uniform_{0.0, 1.0};
+    std::vector<Receiver> receivers_;
+    std::vector<uint64_t> linkFreeAtUs_;
+    // (arrival time, send sequence) -> datagram; the sequence keeps equal
+    // arrival times in send order
+    std::map<std::pair<uint64_t, uint64_t>, Packet> queue_;
+    uint64_t nowUs_;
+    uint64_t nextEventSeq_;
+    Stats stats_;
+};
+
+// Transport of one simulated process
+class SimTransport : public Transport {
+public:
+    SimTransport(SimNetwork& net, unsigned long myId) : net_(net), myId_(myId) {}
+
+    void send(unsigned long targetId, const std::string& data) override {
+        net_.send(myId_, targetId, data);
+    }
+
+    Clock::time_point now() const override { return net_.now(); }
+
+private:
+    SimNetwork& net_;
+    unsigned long myId_;
+};
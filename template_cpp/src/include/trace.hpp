@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Binary event tracing for the protocol stack. Trace points compile to
+// nothing unless the build defines DA_TRACE (cmake -DDA_TRACE=ON). Events go
+// into a per-thread buffer without locking and are appended to the trace file
+// whenever a buffer fills up and on flush(). tools/trace2chrome.py converts
+// trace files of several processes into one Chrome trace / Perfetto JSON.
+//
+// File layout: 8 byte magic "DATRACE1", u32 process id, u32 event size, then
+// TraceEvent records in host byte order.
+
+enum class TraceKind : uint8_t {
+    Send,        // peer = target, a = PL seq, b = message type
+    Receive,     // peer = sender, a = PL seq, b = message type
+    Ack,         // peer = acker, a = PL seq
+    Retransmit,  // peer = target, a = PL seq, b = message type
+    Relay,       // a = origin, b = origin seq
+    UrbDeliver,  // a = origin, b = origin seq
+    FifoDeliver, // a = origin, b = origin seq
+    Propose,     // a = slot, b = proposal number
+    LaAck,       // peer = acceptor, a = slot, b = proposal number
+    Nack,        // peer = acceptor, a = slot, b = proposal number
+    Decide,      // a = slot, b = rounds
+};
+
+struct TraceEvent {
+    uint64_t tsNs;
+    uint64_t a;
+    uint64_t b;
+    uint32_t peer;
+    uint8_t kind;
+    uint8_t pad[3];
+};
+
+static_assert(sizeof(TraceEvent) == 32, "trace record layout changed");
+
+class Tracer {
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool open(const std::string& path, uint32_t processId) {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        uint32_t eventSize = sizeof(TraceEvent);
+        std::fwrite("DATRACE1", 1, 8, file_);
+        std::fwrite(&processId, sizeof(processId), 1, file_);
+        std::fwrite(&eventSize, sizeof(eventSize), 1, file_);
+        return true;
+    }
+
+    void record(TraceKind kind, uint64_t peer, uint64_t a, uint64_t b) {
+        if (file_ == nullptr) {
+            return;
+        }
+
+        Ring& ring = localRing();
+        TraceEvent& ev = ring.events[ring.size++];
+        ev.tsNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        ev.a = a;
+        ev.b = b;
+        ev.peer = static_cast<uint32_t>(peer);
+        ev.kind = static_cast<uint8_t>(kind);
+        std::memset(ev.pad, 0, sizeof(ev.pad));
+
+        if (ring.size == kRingEvents) {
+            flush(ring);
+        }
+    }
+
+    // Writes out the calling thread's buffered events
+    void flush() {
+        if (file_ == nullptr) {
+            return;
+        }
+        flush(localRing());
+        std::fflush(file_);
+    }
+
+private:
+    static constexpr size_t kRingEvents = 1 << 16;
+
+    struct Ring {
+        TraceEvent events[kRingEvents];
+        size_t size = 0;
+    };
+
+    static Ring& localRing() {
+        thread_local std::unique_ptr<Ring> ring = std::make_unique<Ring>();
+        return *ring;
+    }
+
+    void flush(Ring& ring) {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        std::fwrite(ring.events, sizeof(TraceEvent), ring.size, file_);
+        ring.size = 0;
+    }
+
+    std::FILE* file_ = nullptr;
+    std::mutex fileMutex_;
+};
+
+#ifdef DA_TRACE
+#define DA_TRACE_EVENT(kind, peer, a, b) \
+    Tracer::instance().record(TraceKind::kind, (peer), (a), (b))
+#else
+#define DA_TRACE_EVENT(kind, peer, a, b) ((void)0)
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Datagram transport underneath PerfectLink. Implementations deliver
+// unreliably; PerfectLink adds acknowledgements and retransmission on top.
+class Transport {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~Transport() = default;
+
+    // Send one datagram to the process with the given id
+    virtual void send(unsigned long targetId, const std::string& data) = 0;
+
+    // Current time as seen by the protocol (virtual in simulation)
+    virtual Clock::time_point now() const { return Clock::now(); }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "metrics.hpp"
+#include "transport.hpp"
+#include "parser.hpp"
+
+// Transport over a single bound UDP socket shared by all peers
+class UdpTransport : public Transport {
+public:
+    UdpTransport(int sockfd, const std::vector<Parser::Host>& hosts)
+        : sockfd_(sockfd) {
+        // Host ids are compact (1..N), so addresses are indexed directly by id
+        addrs_.resize(hosts.size() + 1);
+        for (const auto& host : hosts) {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = host.ip;
+            addr.sin_port = host.port;
+            addrs_[host.id] = addr;
+            hostByAddr_[addrKey(host.ip, host.port)] = host.id;
+        }
+    }
+
+    void send(unsigned long targetId, const std::string& data) override {
+        const struct sockaddr_in& addr = addrs_[targetId];
+        if (sendto(sockfd_, data.c_str(), data.size(), 0, reinterpret_cast<const struct sockaddr*>(&addr),
+                   sizeof(addr)) < 0) {
+            // PerfectLink retransmits; counted so failures stay visible
+            sendErrors_.add();
+        }
+    }
+
+    // Wait up to `timeoutUs` for one datagram and hand it to
+    // `deliver(from, data, size)` if it came from a known host. Returns
+    // false if nothing was readable before the timeout.
+    template <typename Fn>
+    bool poll(long timeoutUs, Fn&& deliver) {
+        // Without a timeout a non-blocking read answers in one syscall
+        if (timeoutUs > 0) {
+            fd_set readfds;
+            FD_ZERO(&readfds);
+            FD_SET(sockfd_, &readfds);
+
+            struct timeval tv;
+            tv.tv_sec = 0;
+            tv.tv_usec = timeoutUs;
+
+            int ready = select(sockfd_ + 1, &readfds, nullptr, nullptr, &tv);
+            if (ready <= 0 || !FD_ISSET(sockfd_, &readfds)) {
+                return false;
+            }
+        }
+
+        struct sockaddr_in sender_addr;
+        socklen_t sender_len = sizeof(sender_addr);
+        ssize_t n = recvfrom(sockfd_, buffer_.data(), buffer_.size(), MSG_DONTWAIT,
+                             reinterpret_cast<struct sockaddr*>(&sender_addr), &sender_len);
+        if (n < 0) {
+            return false;
+        }
+        unsigned long from;
+        if (n > 0 && hostOf(sender_addr, from)) {
+            deliver(from, buffer_.data(), static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    // Resolve a source address to a host id; false for unknown senders
+    bool hostOf(const struct sockaddr_in& addr, unsigned long& id) const {
+        auto it = hostByAddr_.find(addrKey(addr.sin_addr.s_addr, addr.sin_port));
+        if (it == hostByAddr_.end()) {
+            return false;
+        }
+        id = it->second;
+        return true;
+    }
+
+    int fd() const { return sockfd_; }
+
+    const struct sockaddr_in& addrOf(unsigned long id) const { return addrs_[id]; }
+
+    void registerMetrics(MetricsRegistry& registry) const { registry.add("udp.send_errors", sendErrors_); }
+
+private:
+    int sockfd_;
+    Counter sendErrors_;
+
+    // Destination address per host id, built once at construction
+    std::vector<struct sockaddr_in> addrs_;
+
+    // Source address (ip, port) -> host id
+    std::unordered_map<uint64_t, unsigned long> hostByAddr_;
+
+    // Large enough for any UDP datagram
+    std::vector<char> buffer_ = std::vector<char>(65536);
+
+    static uint64_t addrKey(in_addr_t ip, in_port_t port) {
+        return (static_cast<uint64_t>(ip) << 16) | port;
+    }
+};
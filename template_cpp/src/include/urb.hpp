@@ -1,84 +1,444 @@
 #pragma once
 
 #include "perfect_link.hpp"
+#include <charconv>
 #include <set>
 #include <map>
 #include <iostream>
+#include <utility>
+#include <vector>
 
+// Majority-ack uniform reliable broadcast. Two dissemination modes:
+//
+// Relay: every process relays the full message to all processes on first
+// receipt; each relay doubles as the relayer's ack (N^2 payloads per
+// broadcast).
+//
+// Vote: only the origin sends the payload. A process that holds the payload
+// announces it with an (origin, seq) vote to all processes; votes are
+// batched into one URB_VOTE message per flush. A process that sees votes for
+// a payload it still lacks after kRequestDelay asks one voter at a time for
+// it (URB_REQUEST). Only one request per payload is out at a time: the next
+// voter is asked once the current one is suspected or an exponential
+// backoff runs out, and at most kMaxOutstandingRequests are out in total.
+// Since a delivering process has seen a majority of votes, at least one
+// correct process holds the payload and answers, so uniform agreement is
+// preserved.
+//
+// Tree: as Vote, but the payload travels down a fanout-ary spanning tree
+// rooted at the origin instead of going from the origin to everybody, so no
+// process sends more than `fanout` copies of a payload. The origin still
+// votes to everybody, so subtrees cut off by a crashed inner node (even all
+// children of the origin) see the votes and fetch the payload through
+// URB_REQUEST; a process that gets a payload that way forwards it to its
+// own children, which heals the rest of the subtree.
+//
+// Sends through `Link` (a PerfectLink); deliveries go to
+// `Upper::urbDeliver(from, msg)`.
+enum class UrbMode { Relay, Vote, Tree };
+
+constexpr unsigned long kDefaultUrbFanout = 4;
+
+template <typename Link, typename Upper>
 class UniformReliableBroadcast {
 public:
-    using DeliverCallback = std::function<void(unsigned long from, const Message& msg)>;
+    using Mode = UrbMode;
 
-    UniformReliableBroadcast(unsigned long myId, PerfectLink& pl, int numProcesses, DeliverCallback callback)
-        : myId_(myId), pl_(pl), numProcesses_(numProcesses), callback_(callback), pl_seq_(0) {}
+    UniformReliableBroadcast(unsigned long myId, Link& pl, int numProcesses, Upper& upper,
+                             Mode mode = Mode::Relay, unsigned long fanout = kDefaultUrbFanout)
+        : myId_(myId), pl_(pl), numProcesses_(numProcesses), upper_(upper), pl_seq_(0), mode_(mode),
+          fanout_(std::max(fanout, 1UL)) {}
+
+    static bool handles(MessageType type) {
+        return type == MessageType::URB_MSG || type == MessageType::URB_VOTE || type == MessageType::URB_REQUEST;
+    }
 
     void broadcast(const Message& msg) {
         std::pair<unsigned long, unsigned long> msgId = {msg.original_sender_id, msg.original_seq_no};
-        
+
         if (forwarded_.find(msgId) == forwarded_.end()) {
+            stats_.broadcasts.add();
             pending_[msgId] = msg;
             forwarded_.insert(msgId);
             acks_[msgId].insert(myId_); // We have seen it
-            
-            for (int i = 1; i <= numProcesses_; ++i) {
-                    Message toSend = msg;
-                    toSend.sender_id = myId_;
-                    toSend.seq_no = ++pl_seq_;
-                    
-                    pl_.send(i, toSend);
+
+            if (mode_ == Mode::Relay) {
+                for (int i = 1; i <= numProcesses_; ++i) {
+                        Message toSend = msg;
+                        toSend.sender_id = static_cast<uint32_t>(myId_);
+                        toSend.seq_no = ++pl_seq_;
+
+                        pl_.send(i, toSend);
+                }
+            } else {
+                // Receiving the payload from us counts as our vote, but in
+                // tree mode only our children get it: everybody also needs
+                // the vote to fetch the payload if all of them crash
+                disseminate(msg);
+                voteBatch_.push_back(msgId);
+                if (voteBatch_.size() >= kMaxVotesPerBatch) {
+                    flushVotes();
+                }
+                tryDeliver(msgId);
             }
         }
     }
 
     void deliver(unsigned long from, const Message& msg) {
+        if (mode_ == Mode::Relay) {
+            deliverRelay(from, msg);
+            return;
+        }
+
+        switch (msg.type) {
+            case MessageType::URB_MSG:
+                receivePayload(from, msg);
+                break;
+            case MessageType::URB_VOTE:
+                receiveVotes(from, msg.payload);
+                break;
+            case MessageType::URB_REQUEST:
+                receiveRequest(from, msg);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Flushes batched votes and re-requests missing payloads; call from the
+    // event loop
+    void update() {
+        if (mode_ == Mode::Relay) {
+            return;
+        }
+
+        flushVotes();
+
+        if (missing_.empty()) {
+            return;
+        }
+        auto now = pl_.now();
+        for (auto& [msgId, missing] : missing_) {
+            // One request per payload at a time. PerfectLink delivers it
+            // unless the voter crashed, so only move on once the voter is
+            // suspected or the backoff runs out.
+            if (now < missing.nextRequest && (missing.asked == 0 || !pl_.suspects(missing.asked))) {
+                continue;
+            }
+            if (missing.asked != 0) {
+                missing.asked = 0;
+                --outstandingRequests_;
+            }
+            if (outstandingRequests_ >= kMaxOutstandingRequests) {
+                // Lower (origin, seq) come first in the map and keep priority
+                stats_.requestsDeferred.add();
+                break;
+            }
+
+            unsigned long voter = nextVoter(msgId, missing.lastAsked);
+            if (voter == 0) {
+                missing.nextRequest = now + kRequestDelay;
+                continue;
+            }
+
+            Message request;
+            request.type = MessageType::URB_REQUEST;
+            request.sender_id = static_cast<uint32_t>(myId_);
+            request.seq_no = ++pl_seq_;
+            request.original_sender_id = static_cast<uint32_t>(msgId.first);
+            request.original_seq_no = static_cast<uint32_t>(msgId.second);
+            pl_.send(voter, request);
+            stats_.payloadRequests.add();
+
+            missing.asked = voter;
+            missing.lastAsked = voter;
+            missing.nextRequest = now + missing.backoff;
+            missing.backoff = std::min<Transport::Clock::duration>(missing.backoff * 2, kMaxRequestBackoff);
+            ++outstandingRequests_;
+        }
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("urb.broadcasts", stats_.broadcasts);
+        registry.add("urb.relays", stats_.relays);
+        registry.add("urb.delivered", stats_.delivered);
+        registry.add("urb.vote_batches_sent", stats_.voteBatches);
+        registry.add("urb.votes_sent", stats_.votesSent);
+        registry.add("urb.votes_received", stats_.votesReceived);
+        registry.add("urb.payload_requests", stats_.payloadRequests);
+        registry.add("urb.payload_resends", stats_.payloadResends);
+        registry.add("urb.requests_deferred", stats_.requestsDeferred);
+        registry.add("urb.requests_outstanding", [this]() noexcept {
+            return static_cast<uint64_t>(outstandingRequests_);
+        });
+        registry.add("urb.pending", [this]() noexcept { return static_cast<uint64_t>(pending_.size()); });
+        registry.add("urb.forwarded", [this]() noexcept { return static_cast<uint64_t>(forwarded_.size()); });
+        registry.add("urb.missing_payloads", [this]() noexcept { return static_cast<uint64_t>(missing_.size()); });
+        registry.add("urb.ack_sets", [this]() noexcept { return static_cast<uint64_t>(acks_.size()); });
+        registry.add("urb.ack_entries", [this]() noexcept {
+            uint64_t total = 0;
+            for (const auto& [msgId, ackers] : acks_) {
+                total += ackers.size();
+            }
+            return total;
+        });
+    }
+
+private:
+    using MsgId = std::pair<unsigned long, unsigned long>;
+
+    struct Stats {
+        Counter broadcasts;
+        Counter relays;
+        Counter delivered;
+        Counter voteBatches;
+        Counter votesSent;
+        Counter votesReceived;
+        Counter payloadRequests;
+        Counter payloadResends;
+        Counter requestsDeferred; // rounds cut short by the request cap
+    };
+
+    // A message we saw votes for but hold no payload of. `asked` is the
+    // voter our outstanding request went to, 0 if none is outstanding.
+    struct MissingPayload {
+        Transport::Clock::time_point nextRequest;
+        Transport::Clock::duration backoff = kRequestDelay;
+        unsigned long asked = 0;
+        unsigned long lastAsked = 0;
+    };
+
+    static constexpr std::chrono::milliseconds kRequestDelay{200};
+    static constexpr std::chrono::milliseconds kMaxRequestBackoff{6400};
+    static constexpr size_t kMaxOutstandingRequests = 256;
+    static constexpr size_t kMaxVotesPerBatch = 256;
+
+    unsigned long myId_;
+    Link& pl_;
+    int numProcesses_;
+    Upper& upper_;
+    unsigned long pl_seq_;
+    Mode mode_;
+    unsigned long fanout_;
+
+    // Map of (sender, seq) -> Message
+    PoolMap<std::pair<unsigned long, unsigned long>, Message> pending_;
+
+    // Set of forwarded messages (sender, seq)
+    PoolSet<std::pair<unsigned long, unsigned long>> forwarded_;
+
+    // Map of (sender, seq) -> Set of ACKs (process IDs)
+    PoolMap<std::pair<unsigned long, unsigned long>, PoolSet<unsigned long>> acks_;
+
+    // Set of delivered messages (sender, seq)
+    PoolSet<std::pair<unsigned long, unsigned long>> delivered_;
+
+    // Vote and tree mode: votes not yet flushed, payloads to fetch
+    std::vector<MsgId> voteBatch_;
+    PoolMap<MsgId, MissingPayload> missing_;
+    size_t outstandingRequests_ = 0;
+
+    Stats stats_;
+
+    bool canDeliver(const std::pair<unsigned long, unsigned long>& msgId) {
+        return acks_[msgId].size() > static_cast<size_t>(numProcesses_ / 2);
+    }
+
+    void deliverRelay(unsigned long from, const Message& msg) {
         std::pair<unsigned long, unsigned long> msgId = {msg.original_sender_id, msg.original_seq_no};
-        
+
         acks_[msgId].insert(from);
         acks_[msgId].insert(myId_);
-        
+
         if (pending_.find(msgId) == pending_.end()) {
             pending_[msgId] = msg;
         }
 
         if (forwarded_.find(msgId) == forwarded_.end()) {
             forwarded_.insert(msgId);
-            
+            stats_.relays.add();
+            DA_TRACE_EVENT(Relay, 0, msg.original_sender_id, msg.original_seq_no);
+
             for (int i = 1; i <= numProcesses_; ++i) {
                     Message toSend = msg;
-                    toSend.sender_id = myId_;
+                    toSend.sender_id = static_cast<uint32_t>(myId_);
                     toSend.seq_no = ++pl_seq_;
                     pl_.send(i, toSend);
             }
         }
-        
-        // std::cout << "URB: acks for " << msg.original_sender_id << ":" << msg.original_seq_no << " are " << acks_[msgId].size() << "\n";
-        
+
         if (canDeliver(msgId) && delivered_.find(msgId) == delivered_.end()) {
             delivered_.insert(msgId);
-            callback_(msg.original_sender_id, msg);
+            stats_.delivered.add();
+            DA_TRACE_EVENT(UrbDeliver, 0, msg.original_sender_id, msg.original_seq_no);
+            upper_.urbDeliver(msg.original_sender_id, msg);
         }
     }
 
-private:
-    unsigned long myId_;
-    PerfectLink& pl_;
-    int numProcesses_;
-    DeliverCallback callback_;
-    unsigned long pl_seq_;
-    
-    // Map of (sender, seq) -> Message
-    std::map<std::pair<unsigned long, unsigned long>, Message> pending_;
-    
-    // Set of forwarded messages (sender, seq)
-    std::set<std::pair<unsigned long, unsigned long>> forwarded_;
-    
-    // Map of (sender, seq) -> Set of ACKs (process IDs)
-    std::map<std::pair<unsigned long, unsigned long>, std::set<unsigned long>> acks_;
-    
-    // Set of delivered messages (sender, seq)
-    std::set<std::pair<unsigned long, unsigned long>> delivered_;
+    void sendPayload(unsigned long target, const Message& msg) {
+        Message toSend = msg;
+        toSend.type = MessageType::URB_MSG;
+        toSend.sender_id = static_cast<uint32_t>(myId_);
+        toSend.seq_no = ++pl_seq_;
+        pl_.send(target, toSend);
+    }
 
-    bool canDeliver(const std::pair<unsigned long, unsigned long>& msgId) {
-        return acks_[msgId].size() > static_cast<size_t>(numProcesses_ / 2);
+    // Sends a payload onwards: from the origin to everybody else in vote
+    // mode, to our children in the origin's tree in tree mode
+    void disseminate(const Message& msg) {
+        unsigned long n = static_cast<unsigned long>(numProcesses_);
+        if (mode_ == Mode::Vote) {
+            for (unsigned long i = 1; i <= n; ++i) {
+                if (i != myId_) {
+                    sendPayload(i, msg);
+                }
+            }
+            return;
+        }
+
+        // Ranks count from the origin (rank 0); children of rank r are
+        // r * fanout + 1 .. r * fanout + fanout
+        unsigned long origin = msg.original_sender_id;
+        if (origin < 1 || origin > n || myId_ > n) {
+            return;
+        }
+        unsigned long rank = (myId_ + n - origin) % n;
+        for (unsigned long k = 1; k <= fanout_; ++k) {
+            unsigned long child = rank * fanout_ + k;
+            if (child >= n) {
+                break;
+            }
+            sendPayload((origin - 1 + child) % n + 1, msg);
+        }
+    }
+
+    // Next voter after `last` (round robin) that is neither us nor
+    // suspected; 0 if there is none
+    unsigned long nextVoter(const MsgId& msgId, unsigned long last) {
+        const PoolSet<unsigned long>& voters = acks_[msgId];
+        auto it = voters.upper_bound(last);
+        for (size_t i = 0; i < voters.size(); ++i, ++it) {
+            if (it == voters.end()) {
+                it = voters.begin();
+            }
+            if (*it != myId_ && !pl_.suspects(*it)) {
+                return *it;
+            }
+        }
+        return 0;
+    }
+
+    void resolveMissing(const MsgId& msgId) {
+        auto it = missing_.find(msgId);
+        if (it == missing_.end()) {
+            return;
+        }
+        if (it->second.asked != 0) {
+            --outstandingRequests_;
+        }
+        missing_.erase(it);
+    }
+
+    void receivePayload(unsigned long from, const Message& msg) {
+        MsgId msgId = {msg.original_sender_id, msg.original_seq_no};
+        PoolSet<unsigned long>& ackers = acks_[msgId];
+        ackers.insert(from);
+
+        if (forwarded_.insert(msgId).second) {
+            pending_[msgId] = msg;
+            resolveMissing(msgId);
+            ackers.insert(myId_);
+
+            // Announce that we hold the payload
+            stats_.relays.add();
+            DA_TRACE_EVENT(Relay, 0, msg.original_sender_id, msg.original_seq_no);
+            if (mode_ == Mode::Tree) {
+                disseminate(msg);
+            }
+            voteBatch_.push_back(msgId);
+            if (voteBatch_.size() >= kMaxVotesPerBatch) {
+                flushVotes();
+            }
+        }
+
+        tryDeliver(msgId);
+    }
+
+    void receiveVotes(unsigned long from, std::string_view payload) {
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        while (p < end) {
+            MsgId msgId;
+            auto r1 = std::from_chars(p, end, msgId.first);
+            if (r1.ec != std::errc() || r1.ptr >= end) {
+                return;
+            }
+            auto r2 = std::from_chars(r1.ptr + 1, end, msgId.second);
+            if (r2.ec != std::errc()) {
+                return;
+            }
+            p = r2.ptr < end ? r2.ptr + 1 : end;
+
+            stats_.votesReceived.add();
+            acks_[msgId].insert(from);
+            if (forwarded_.count(msgId) == 0 && missing_.count(msgId) == 0) {
+                missing_[msgId].nextRequest = pl_.now() + kRequestDelay;
+            }
+            tryDeliver(msgId);
+        }
+    }
+
+    void receiveRequest(unsigned long from, const Message& msg) {
+        auto it = pending_.find({msg.original_sender_id, msg.original_seq_no});
+        if (it != pending_.end()) {
+            stats_.payloadResends.add();
+            sendPayload(from, it->second);
+        }
+    }
+
+    void flushVotes() {
+        if (voteBatch_.empty()) {
+            return;
+        }
+
+        Message votes;
+        votes.type = MessageType::URB_VOTE;
+        votes.sender_id = static_cast<uint32_t>(myId_);
+        votes.original_sender_id = 0;
+        votes.original_seq_no = 0;
+        for (const MsgId& msgId : voteBatch_) {
+            if (!votes.payload.empty()) {
+                votes.payload += ' ';
+            }
+            votes.payload += std::to_string(msgId.first);
+            votes.payload += ' ';
+            votes.payload += std::to_string(msgId.second);
+        }
+
+        for (int i = 1; i <= numProcesses_; ++i) {
+            if (static_cast<unsigned long>(i) != myId_) {
+                votes.seq_no = ++pl_seq_;
+                pl_.send(static_cast<unsigned long>(i), votes);
+            }
+        }
+        stats_.voteBatches.add();
+        stats_.votesSent.add(voteBatch_.size());
+        voteBatch_.clear();
+    }
+
+    // Deliver once we hold the payload and a majority holds it too
+    void tryDeliver(const MsgId& msgId) {
+        if (delivered_.count(msgId) != 0 || !canDeliver(msgId)) {
+            return;
+        }
+        auto it = pending_.find(msgId);
+        if (it == pending_.end()) {
+            return;
+        }
+
+        delivered_.insert(msgId);
+        stats_.delivered.add();
+        DA_TRACE_EVENT(UrbDeliver, 0, msgId.first, msgId.second);
+        upper_.urbDeliver(msgId.first, it->second);
     }
 };
@@ -0,0 +1,483 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#include "metrics.hpp"
+#include "transport.hpp"
+#include "udp_transport.hpp"
+
+// Multishot recvmsg and provided buffer rings arrived together (Linux 6.0);
+// older headers build the select() path only
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_FEAT_EXT_ARG) && defined(__NR_io_uring_setup)
+#define DA_HAVE_IO_URING
+#endif
+
+// io_uring backend for the UDP socket, talking to the kernel through the
+// raw syscalls. Sends are queued as SENDMSG entries from preallocated slots
+// and submitted in batches: when the batch fills up, and in poll(), where
+// the submission and the wait for completions are a single syscall. One
+// multishot RECVMSG stays armed on the socket and fills receive buffers the
+// kernel takes from a registered buffer ring, so receiving needs no syscall
+// per datagram either.
+//
+// Until open() succeeds, and in builds without io_uring headers, send() and
+// poll() go straight to the select()/sendto() path of UdpTransport.
+class UringTransport : public Transport {
+public:
+    explicit UringTransport(UdpTransport& udp) : udp_(udp) {}
+
+    ~UringTransport() {
+#ifdef DA_HAVE_IO_URING
+        teardown();
+#endif
+    }
+
+    UringTransport(const UringTransport&) = delete;
+    UringTransport& operator=(const UringTransport&) = delete;
+
+    // Sets up the ring and arms the receive. False if the kernel lacks
+    // io_uring or any feature used here; the socket path is used then.
+    bool open() {
+#ifdef DA_HAVE_IO_URING
+        if (setup()) {
+            return true;
+        }
+        teardown();
+#endif
+        return false;
+    }
+
+    bool active() const { return ringFd_ >= 0; }
+
+    void send(unsigned long targetId, const std::string& data) override {
+#ifdef DA_HAVE_IO_URING
+        if (active() && queueSend(targetId, data)) {
+            return;
+        }
+#endif
+        udp_.send(targetId, data);
+    }
+
+    // Submits queued sends, waits up to `timeoutUs` for datagrams and hands
+    // every one that arrived to `deliver(from, data, size)`. Returns false
+    // if nothing arrived.
+    template <typename Fn>
+    bool poll(long timeoutUs, Fn&& deliver) {
+#ifdef DA_HAVE_IO_URING
+        if (active()) {
+            return pollRing(timeoutUs, deliver);
+        }
+#endif
+        return udp_.poll(timeoutUs, deliver);
+    }
+
+    void registerMetrics(MetricsRegistry& registry) const {
+        registry.add("uring.enters", stats_.enters);
+        registry.add("uring.sends", stats_.sends);
+        registry.add("uring.send_fallbacks", stats_.sendFallbacks);
+        registry.add("uring.send_errors", stats_.sendErrors);
+        registry.add("uring.received", stats_.received);
+        registry.add("uring.truncated", stats_.truncated);
+        udp_.registerMetrics(registry);
+    }
+
+private:
+    struct Stats {
+        Counter enters;
+        Counter sends;
+        Counter sendFallbacks;
+        Counter sendErrors; // send completions with res < 0
+        Counter received;
+        Counter truncated;
+    };
+
+    UdpTransport& udp_;
+    int ringFd_ = -1;
+    Stats stats_;
+
+#ifdef DA_HAVE_IO_URING
+    static constexpr unsigned kSqEntries = 256;
+    static constexpr unsigned kCqEntries = 4096;
+
+    // Sends wait for poll() unless this many are queued
+    static constexpr unsigned kSubmitBatch = 64;
+
+    // Protocol datagrams stay below the PL fragment size; larger ones are
+    // sent directly
+    static constexpr size_t kSendSlots = 512;
+    static constexpr size_t kSendSlotBytes = 2048;
+
+    static constexpr unsigned kRecvBuffers = 512;
+    static constexpr size_t kRecvBufferBytes = 4096;
+    static constexpr uint16_t kBufferGroup = 0;
+    static constexpr uint64_t kRecvTag = ~uint64_t(0);
+
+    struct SendSlot {
+        struct msghdr msg;
+        struct iovec iov;
+        struct sockaddr_in addr;
+        char data[kSendSlotBytes];
+    };
+
+    // A filled receive buffer not yet handed up
+    struct Completed {
+        uint16_t buffer;
+        uint32_t size;
+    };
+
+    bool setup() {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = kCqEntries;
+        ringFd_ = static_cast<int>(syscall(__NR_io_uring_setup, kSqEntries, &params));
+        if (ringFd_ < 0) {
+            return false;
+        }
+        if ((params.features & IORING_FEAT_EXT_ARG) == 0 || (params.features & IORING_FEAT_NODROP) == 0) {
+            return false;
+        }
+
+        sqMapBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        sqesBytes_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqMap_ = map(sqMapBytes_, ringFd_, IORING_OFF_SQ_RING);
+        cqMap_ = map(cqMapBytes_, ringFd_, IORING_OFF_CQ_RING);
+        sqes_ = static_cast<struct io_uring_sqe*>(map(sqesBytes_, ringFd_, IORING_OFF_SQES));
+        if (sqMap_ == nullptr || cqMap_ == nullptr || sqes_ == nullptr) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqMap_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+        sqLocalTail_ = *sqTail_;
+
+        char* cq = static_cast<char*>(cqMap_);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Receive buffers, handed to the kernel through a registered ring
+        bufRingBytes_ = kRecvBuffers * sizeof(struct io_uring_buf);
+        bufRing_ = static_cast<struct io_uring_buf*>(map(bufRingBytes_, -1, 0));
+        if (bufRing_ == nullptr) {
+            return false;
+        }
+        struct io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+        reg.ring_entries = kRecvBuffers;
+        reg.bgid = kBufferGroup;
+        if (syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return false;
+        }
+        recvBuffers_.resize(kRecvBuffers * kRecvBufferBytes);
+        for (unsigned i = 0; i < kRecvBuffers; ++i) {
+            returnBuffer(static_cast<uint16_t>(i));
+        }
+        publishBuffers();
+
+        slots_.resize(kSendSlots);
+        for (size_t i = kSendSlots; i > 0; --i) {
+            freeSlots_.push_back(static_cast<uint32_t>(i - 1));
+        }
+
+        // Kernels without multishot recvmsg fail the request right away
+        std::memset(&recvMsg_, 0, sizeof(recvMsg_));
+        recvMsg_.msg_namelen = sizeof(struct sockaddr_in);
+        armReceive();
+        if (!submit(0, 0)) {
+            return false;
+        }
+        reap();
+        return recvError_ == 0;
+    }
+
+    void teardown() {
+        if (bufRing_ != nullptr) {
+            munmap(bufRing_, bufRingBytes_);
+            bufRing_ = nullptr;
+        }
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqesBytes_);
+            sqes_ = nullptr;
+        }
+        if (cqMap_ != nullptr) {
+            munmap(cqMap_, cqMapBytes_);
+            cqMap_ = nullptr;
+        }
+        if (sqMap_ != nullptr) {
+            munmap(sqMap_, sqMapBytes_);
+            sqMap_ = nullptr;
+        }
+        if (ringFd_ >= 0) {
+            ::close(ringFd_);
+            ringFd_ = -1;
+        }
+    }
+
+    // Shared read-write mapping of the ring `fd`, or anonymous memory for -1
+    static void* map(size_t bytes, int fd, off_t offset) {
+        int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+        void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, fd, offset);
+        return addr == MAP_FAILED ? nullptr : addr;
+    }
+
+    // Next free submission entry, zeroed; submits what is queued if the
+    // queue is full. Null if the kernel has not consumed any entry yet.
+    struct io_uring_sqe* nextSqe() {
+        if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+            submit(0, 0);
+            if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+                return nullptr;
+            }
+        }
+        unsigned index = sqLocalTail_ & sqMask_;
+        struct io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray_[index] = index;
+        ++sqLocalTail_;
+        ++unsubmitted_;
+        return sqe;
+    }
+
+    // Submits the queued entries and, for `minComplete` > 0, waits up to
+    // `timeoutUs` for that many completions, all in one syscall
+    bool submit(unsigned minComplete, long timeoutUs) {
+        __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+        if (unsubmitted_ == 0 && minComplete == 0) {
+            return true;
+        }
+
+        unsigned flags = 0;
+        struct __kernel_timespec ts = {};
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        if (minComplete > 0) {
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+            ts.tv_sec = timeoutUs / 1000000;
+            ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            arg.sigmask_sz = _NSIG / 8;
+        }
+        stats_.enters.add();
+        long submitted = syscall(__NR_io_uring_enter, ringFd_, unsubmitted_, minComplete, flags,
+                                 minComplete > 0 ? &arg : nullptr, minComplete > 0 ? sizeof(arg) : 0);
+        if (submitted < 0) {
+            // Timeouts and signals are normal ends of a wait
+            return errno == ETIME || errno == EINTR;
+        }
+        unsubmitted_ -= static_cast<unsigned>(submitted);
+        return true;
+    }
+
+    // Moves all completions off the completion queue: sends free their
+    // slot, receives are kept in completed_ until poll() hands them up
+    void reap() {
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe& cqe = cqes_[head & cqMask_];
+            if (cqe.user_data != kRecvTag) {
+                // As with sendto(), PerfectLink retransmits what failed
+                if (cqe.res < 0) {
+                    stats_.sendErrors.add();
+                }
+                freeSlots_.push_back(static_cast<uint32_t>(cqe.user_data));
+                continue;
+            }
+            if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                recvArmed_ = false;
+            }
+            if (cqe.res < 0) {
+                // Out of buffers: re-armed once poll() returned some
+                if (cqe.res != -ENOBUFS) {
+                    recvError_ = cqe.res;
+                }
+                continue;
+            }
+            if ((cqe.flags & IORING_CQE_F_BUFFER) != 0) {
+                completed_.push_back({static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT),
+                                      static_cast<uint32_t>(cqe.res)});
+            }
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    }
+
+    void armReceive() {
+        struct io_uring_sqe* sqe = nextSqe();
+        if (sqe == nullptr) {
+            return;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = udp_.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(&recvMsg_);
+        sqe->len = 1;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = kRecvTag;
+        recvArmed_ = true;
+    }
+
+    // Queues one datagram; false if it has to go through sendto() instead
+    bool queueSend(unsigned long targetId, const std::string& data) {
+        if (data.size() > kSendSlotBytes) {
+            stats_.sendFallbacks.add();
+            return false;
+        }
+        if (freeSlots_.empty()) {
+            submit(0, 0);
+            reap();
+        }
+        struct io_uring_sqe* sqe = freeSlots_.empty() ? nullptr : nextSqe();
+        if (sqe == nullptr) {
+            stats_.sendFallbacks.add();
+            return false;
+        }
+
+        uint32_t index = freeSlots_.back();
+        freeSlots_.pop_back();
+        SendSlot& slot = slots_[index];
+        std::memcpy(slot.data, data.data(), data.size());
+        slot.addr = udp_.addrOf(targetId);
+        slot.iov.iov_base = slot.data;
+        slot.iov.iov_len = data.size();
+        std::memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.msg.msg_name = &slot.addr;
+        slot.msg.msg_namelen = sizeof(slot.addr);
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = udp_.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+        sqe->len = 1;
+        sqe->user_data = index;
+        stats_.sends.add();
+
+        if (unsubmitted_ >= kSubmitBatch) {
+            submit(0, 0);
+        }
+        return true;
+    }
+
+    template <typename Fn>
+    bool pollRing(long timeoutUs, Fn& deliver) {
+        reap();
+        if (!recvArmed_) {
+            armReceive();
+        }
+        submit(completed_.empty() && timeoutUs > 0 ? 1 : 0, timeoutUs);
+        reap();
+
+        // Deliveries may send and thereby reap more completions, so walk
+        // by index and copy each entry before handing it up
+        size_t received = 0;
+        for (size_t i = 0; i < completed_.size(); ++i) {
+            Completed done = completed_[i];
+            handOver(done, deliver);
+            returnBuffer(done.buffer);
+            ++received;
+        }
+        completed_.clear();
+        publishBuffers();
+        if (!recvArmed_) {
+            armReceive();
+        }
+        stats_.received.add(received);
+        return received > 0;
+    }
+
+    // A receive buffer holds the recvmsg header, the source address and the
+    // datagram; see io_uring_recvmsg_out
+    template <typename Fn>
+    void handOver(const Completed& done, Fn& deliver) {
+        const char* buffer = &recvBuffers_[done.buffer * kRecvBufferBytes];
+        struct io_uring_recvmsg_out out;
+        std::memcpy(&out, buffer, sizeof(out));
+        if ((out.flags & MSG_TRUNC) != 0) {
+            stats_.truncated.add();
+            return;
+        }
+        if (out.payloadlen == 0 || out.namelen < sizeof(struct sockaddr_in)) {
+            return;
+        }
+
+        struct sockaddr_in source;
+        std::memcpy(&source, buffer + sizeof(out), sizeof(source));
+        const char* payload = buffer + sizeof(out) + recvMsg_.msg_namelen + recvMsg_.msg_controllen;
+        unsigned long from;
+        if (udp_.hostOf(source, from)) {
+            deliver(from, payload, static_cast<size_t>(out.payloadlen));
+        }
+    }
+
+    void returnBuffer(uint16_t id) {
+        struct io_uring_buf& buf = bufRing_[bufTail_ & (kRecvBuffers - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(&recvBuffers_[id * kRecvBufferBytes]);
+        buf.len = static_cast<uint32_t>(kRecvBufferBytes);
+        buf.bid = id;
+        ++bufTail_;
+    }
+
+    // The ring tail overlays the reserved field of the first entry
+    // (io_uring_buf_ring, whose flexible array C++ lays out differently)
+    void publishBuffers() { __atomic_store_n(&bufRing_[0].resv, bufTail_, __ATOMIC_RELEASE); }
+
+    // Submission queue
+    void* sqMap_ = nullptr;
+    size_t sqMapBytes_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqesBytes_ = 0;
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned sqLocalTail_ = 0;
+    unsigned unsubmitted_ = 0;
+
+    // Completion queue
+    void* cqMap_ = nullptr;
+    size_t cqMapBytes_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    // Receive side
+    struct io_uring_buf* bufRing_ = nullptr;
+    size_t bufRingBytes_ = 0;
+    uint16_t bufTail_ = 0;
+    std::vector<char> recvBuffers_;
+    struct msghdr recvMsg_;
+    bool recvArmed_ = false;
+    int recvError_ = 0;
+    std::vector<Completed> completed_;
+
+    // Send side; slots stay in place while the kernel reads them
+    std::vector<SendSlot> slots_;
+    std::vector<uint32_t> freeSlots_;
+#endif
+};
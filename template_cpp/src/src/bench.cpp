@@ -0,0 +1,444 @@
+// Microbenchmarks for the per-message hot paths of the protocol stack.
+//
+// Usage: da_bench [--filter SUBSTRING] [--min-time-ms MS]
+//
+// Results are written to stdout as one JSON document so runs can be diffed
+// across commits; a human readable table goes to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "transport.hpp"
+#include "protocol_stack.hpp"
+#include "shm_transport.hpp"
+
+namespace {
+
+using BenchClock = std::chrono::steady_clock;
+
+// Swallows outgoing datagrams, only counting them
+class NullTransport : public Transport {
+public:
+  void send(unsigned long, const std::string &data) override {
+    packets++;
+    bytes += data.size();
+  }
+
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+};
+
+// Upper layer for any layer under test, dropping what it is handed
+struct NullUpper {
+  size_t delivered = 0;
+
+  void plDeliver(unsigned long, const Message &) { delivered++; }
+  void urbDeliver(unsigned long, const Message &) { delivered++; }
+  void fifoDeliver(unsigned long, const Message &) { delivered++; }
+  template <typename Set> void decide(int, const Set &) { delivered++; }
+};
+
+using NullLink = PerfectLink<NullUpper>;
+
+// Keeps results observable so the optimizer cannot drop the measured work
+volatile size_t sink;
+
+class BenchState {
+public:
+  explicit BenchState(uint64_t iterations)
+      : iterations(iterations), start_(BenchClock::now()) {}
+
+  // Excludes setup done so far from the measurement
+  void resetTimer() { start_ = BenchClock::now(); }
+
+  double elapsedNs() const {
+    return static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() -
+                                                             start_)
+            .count());
+  }
+
+  const uint64_t iterations;
+
+private:
+  BenchClock::time_point start_;
+};
+
+struct BenchResult {
+  std::string name;
+  uint64_t iterations;
+  double nsPerOp;
+};
+
+class BenchRunner {
+public:
+  BenchRunner(std::string filter, double minTimeNs)
+      : filter_(std::move(filter)), minTimeNs_(minTimeNs) {}
+
+  // Runs `body` with growing iteration counts until it takes at least the
+  // minimum time, then records the last run
+  void run(const std::string &name, const std::function<void(BenchState &)> &body) {
+    if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+      return;
+    }
+
+    uint64_t iterations = 1;
+    while (true) {
+      BenchState state(iterations);
+      body(state);
+      double ns = state.elapsedNs();
+      if (ns >= minTimeNs_ || iterations >= (1ULL << 30)) {
+        results_.push_back({name, iterations, ns / static_cast<double>(iterations)});
+        std::cerr << std::left << std::setw(36) << name << std::right
+                  << std::setw(12) << iterations << std::setw(14)
+                  << std::fixed << std::setprecision(1)
+                  << results_.back().nsPerOp << " ns/op\n";
+        return;
+      }
+
+      // Aim past the minimum time, growing at most 10x per round
+      double scale = ns > 0 ? 1.4 * minTimeNs_ / ns : 10.0;
+      scale = std::min(std::max(scale, 2.0), 10.0);
+      iterations = static_cast<uint64_t>(static_cast<double>(iterations) * scale);
+    }
+  }
+
+  void printJson(std::ostream &os) const {
+    os << "{\"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      const BenchResult &r = results_[i];
+      os << (i == 0 ? "\n" : ",\n") << "  {\"name\": \"" << r.name
+         << "\", \"iterations\": " << r.iterations << ", \"ns_per_op\": "
+         << std::fixed << std::setprecision(2) << r.nsPerOp
+         << ", \"ops_per_sec\": " << std::setprecision(0)
+         << (r.nsPerOp > 0 ? 1e9 / r.nsPerOp : 0.0) << "}";
+    }
+    os << "\n]}\n";
+  }
+
+private:
+  std::string filter_;
+  double minTimeNs_;
+  std::vector<BenchResult> results_;
+};
+
+Message makeUrbMessage(unsigned long sender, unsigned long seq,
+                       unsigned long origin, unsigned long originSeq) {
+  Message msg;
+  msg.type = MessageType::URB_MSG;
+  msg.sender_id = static_cast<uint32_t>(sender);
+  msg.seq_no = seq;
+  msg.original_sender_id = static_cast<uint32_t>(origin);
+  msg.original_seq_no = static_cast<uint32_t>(originSeq);
+  msg.payload = std::to_string(originSeq);
+  return msg;
+}
+
+std::set<int> makeSet(std::mt19937 &rng, size_t size, int range) {
+  std::set<int> s;
+  while (s.size() < size) {
+    s.insert(static_cast<int>(rng() % static_cast<unsigned>(range)));
+  }
+  return s;
+}
+
+void benchMessage(BenchRunner &runner) {
+  runner.run("message/serialize", [](BenchState &st) {
+    Message msg = makeUrbMessage(3, 123456, 7, 98765);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      msg.seq_no = i;
+      sink = msg.serialize().size();
+    }
+  });
+
+  runner.run("message/deserialize", [](BenchState &st) {
+    std::string data = makeUrbMessage(3, 123456, 7, 98765).serialize();
+    Message msg;
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      Message::deserialize(data, msg);
+      sink = msg.seq_no;
+    }
+  });
+
+  runner.run("message/deserialize_la_set_100", [](BenchState &st) {
+    std::mt19937 rng(1);
+    Message msg;
+    msg.type = MessageType::LA_PROPOSAL;
+    msg.sender_id = 2;
+    msg.seq_no = 1;
+    msg.original_sender_id = 5;
+    msg.original_seq_no = 1;
+    for (int x : makeSet(rng, 100, 1 << 20)) {
+      msg.payload += std::to_string(x) + " ";
+    }
+    std::string data = msg.serialize();
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      Message::deserialize(data, msg);
+      sink = msg.payload.size();
+    }
+  });
+
+  // One op: copying a message into a queue slot, as the layers do on relay
+  runner.run("message/copy_small", [](BenchState &st) {
+    Message msg = makeUrbMessage(3, 123456, 7, 98765);
+    std::vector<Message> slots(64);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      slots[i % slots.size()] = msg;
+    }
+    sink = slots[0].payload.size();
+  });
+
+  runner.run("message/copy_la_set_100", [](BenchState &st) {
+    std::mt19937 rng(1);
+    Message msg = makeUrbMessage(3, 123456, 7, 98765);
+    std::string payload;
+    for (int x : makeSet(rng, 100, 1 << 20)) {
+      payload += std::to_string(x) + " ";
+    }
+    msg.payload = payload;
+    std::vector<Message> slots(64);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      slots[i % slots.size()] = msg;
+    }
+    sink = slots[0].payload.size();
+  });
+}
+
+void benchPerfectLink(BenchRunner &runner) {
+  runner.run("pl/receive_new", [](BenchState &st) {
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    std::vector<std::string> packets;
+    packets.reserve(st.iterations);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      packets.push_back(makeUrbMessage(2, i + 1, 2, i + 1).serialize());
+    }
+    st.resetTimer();
+    for (const std::string &data : packets) {
+      pl.receive(data, 2);
+    }
+  });
+
+  runner.run("pl/receive_duplicate", [](BenchState &st) {
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    std::string data = makeUrbMessage(2, 1, 2, 1).serialize();
+    pl.receive(data, 2);
+    st.resetTimer();
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      pl.receive(data, 2);
+    }
+  });
+
+  // Ack handling while 10000 messages to the same peer stay pending. Each
+  // op sends a fresh message and acknowledges the oldest one in flight, so
+  // the ACK scans the whole transmitted prefix (the window, growing to
+  // kMaxWindow) while the rest waits in the backlog.
+  runner.run("pl/ack_with_10k_pending", [](BenchState &st) {
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    MetricsRegistry registry;
+    pl.registerMetrics(registry);
+    const unsigned long backlog = 10000;
+    for (unsigned long seq = 1; seq <= backlog; ++seq) {
+      pl.send(2, makeUrbMessage(1, seq, 1, seq));
+    }
+    std::vector<std::string> acks;
+    acks.reserve(st.iterations);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      Message ack;
+      ack.type = MessageType::PL_ACK;
+      ack.sender_id = 2;
+      ack.seq_no = i + 1;
+      ack.original_sender_id = 1;
+      ack.original_seq_no = static_cast<uint32_t>(i + 1);
+      acks.push_back(ack.serialize());
+    }
+    st.resetTimer();
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      unsigned long seq = backlog + i + 1;
+      pl.send(2, makeUrbMessage(1, seq, 1, seq));
+      pl.receive(acks[i], 2);
+    }
+    // Every ACK must have removed its message, or the ops measured a scan
+    // that found nothing
+    if (registry.value("pl.pending_messages") != backlog) {
+      std::cerr << "pl/ack_with_10k_pending: "
+                << registry.value("pl.pending_messages")
+                << " messages pending, expected " << backlog << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+  });
+}
+
+// One op: a message from process 1 fully URB-delivered at process 1 of a
+// 10 process system, receiving relays from a majority
+void benchUrb(BenchRunner &runner) {
+  runner.run("urb/deliver_majority_n10", [](BenchState &st) {
+    const int n = 10;
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    UniformReliableBroadcast<NullLink, NullUpper> urb(1, pl, n, upper);
+    unsigned long plSeq = 0;
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      for (unsigned long from = 2; from <= n / 2 + 1; ++from) {
+        urb.deliver(from, makeUrbMessage(from, ++plSeq, 3, i + 1));
+      }
+    }
+  });
+}
+
+// Messages arrive in reversed blocks of 64 so the reorder buffer is used
+void benchFifo(BenchRunner &runner) {
+  runner.run("fifo/deliver_reordered_64", [](BenchState &st) {
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    UniformReliableBroadcast<NullLink, NullUpper> urb(1, pl, 3, upper);
+    FIFOBroadcast<UniformReliableBroadcast<NullLink, NullUpper>, NullUpper> fifo(1, urb, upper);
+    std::vector<Message> msgs;
+    msgs.reserve(st.iterations);
+    for (uint64_t base = 0; base < st.iterations; base += 64) {
+      uint64_t end = std::min<uint64_t>(base + 64, st.iterations);
+      for (uint64_t seq = end; seq > base; --seq) {
+        msgs.push_back(makeUrbMessage(2, seq, 2, seq));
+      }
+    }
+    st.resetTimer();
+    for (const Message &msg : msgs) {
+      fifo.deliver(2, msg);
+    }
+    sink = upper.delivered;
+  });
+}
+
+// One op: a URB payload packet from process 2 taken from PerfectLink::receive
+// through URB and FIFO to the sink, in a 3 process system
+void benchStack(BenchRunner &runner) {
+  runner.run("stack/receive_to_fifo_deliver", [](BenchState &st) {
+    NullTransport transport;
+    NullUpper output;
+    FifoStack<NullUpper> stack(1, transport, 3, output);
+    std::vector<std::string> packets;
+    packets.reserve(st.iterations);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      packets.push_back(makeUrbMessage(2, i + 1, 2, i + 1).serialize());
+    }
+    st.resetTimer();
+    for (const std::string &packet : packets) {
+      stack.pl.receive(packet, 2);
+    }
+    sink = output.delivered;
+  });
+}
+
+// One op: a serialized URB packet through a shared-memory ring, written
+// and read back by the same thread (no cross-core traffic)
+void benchShm(BenchRunner &runner) {
+  runner.run("shm/ring_push_pop", [](BenchState &st) {
+    std::vector<uint64_t> memory(ShmRing::kBytes / sizeof(uint64_t) + 8);
+    char *base = reinterpret_cast<char *>(memory.data());
+    base += (64 - reinterpret_cast<uintptr_t>(base) % 64) % 64;
+    new (base) ShmRing::Header{};
+    ShmRing ring(base);
+    std::string packet = makeUrbMessage(2, 1, 2, 1).serialize();
+    size_t bytes = 0;
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      ring.push(packet.data(), packet.size());
+      ring.pop([&bytes](const char *, size_t size) { bytes += size; });
+    }
+    sink = bytes;
+  });
+}
+
+void benchLattice(BenchRunner &runner) {
+  runner.run("la/subset_100_in_1000", [](BenchState &st) {
+    std::mt19937 rng(1);
+    std::set<int> big = makeSet(rng, 1000, 1 << 20);
+    std::set<int> small;
+    for (int x : big) {
+      if (rng() % 10 == 0) {
+        small.insert(x);
+      }
+    }
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      sink = std::includes(big.begin(), big.end(), small.begin(), small.end());
+    }
+  });
+
+  runner.run("la/join_100_into_1000", [](BenchState &st) {
+    std::mt19937 rng(1);
+    std::set<int> base = makeSet(rng, 1000, 1 << 20);
+    std::set<int> other = makeSet(rng, 100, 1 << 20);
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      std::set<int> joined = base;
+      joined.insert(other.begin(), other.end());
+      sink = joined.size();
+    }
+  });
+
+  // Acceptor side: one proposal of 100 values per slot, answered with ACK
+  runner.run("la/handle_proposal_100", [](BenchState &st) {
+    std::mt19937 rng(1);
+    NullTransport transport;
+    NullUpper upper;
+    NullLink pl(1, transport, upper);
+    LatticeAgreement<NullLink, NullUpper> la(1, pl, 3, upper);
+    Message msg;
+    msg.type = MessageType::LA_PROPOSAL;
+    msg.sender_id = 2;
+    msg.original_seq_no = 1;
+    for (int x : makeSet(rng, 100, 1 << 20)) {
+      msg.payload += (msg.payload.empty() ? "" : " ") + std::to_string(x);
+    }
+    for (uint64_t i = 0; i < st.iterations; ++i) {
+      msg.seq_no = i + 1;
+      msg.original_sender_id = static_cast<uint32_t>(i);
+      la.receive(2, msg);
+    }
+    sink = transport.packets;
+  });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string filter;
+  double minTimeMs = 200;
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 < argc && std::strcmp(argv[i], "--filter") == 0) {
+      filter = argv[i + 1];
+    } else if (i + 1 < argc && std::strcmp(argv[i], "--min-time-ms") == 0) {
+      minTimeMs = std::atof(argv[i + 1]);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter SUBSTRING] [--min-time-ms MS]\n";
+      return 1;
+    }
+  }
+
+  BenchRunner runner(filter, minTimeMs * 1e6);
+  benchMessage(runner);
+  benchPerfectLink(runner);
+  benchUrb(runner);
+  benchFifo(runner);
+  benchStack(runner);
+  benchShm(runner);
+  benchLattice(runner);
+  runner.printJson(std::cout);
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Feeds PerfectLink fragments that disagree with the first fragment of
+// their message and checks they are dropped instead of being copied into
+// the reassembly buffer, which is sized from that first fragment.
+//
+// Usage: da_fragment_test (exit status 0 on success)
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "perfect_link.hpp"
+
+namespace {
+
+class NullTransport : public Transport {
+public:
+  void send(unsigned long, const std::string &) override {}
+};
+
+struct Collector {
+  std::vector<Message> delivered;
+
+  void plDeliver(unsigned long, const Message &msg) {
+    delivered.push_back(msg);
+  }
+};
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    std::cerr << "FAIL: " << what << "\n";
+    failures++;
+  }
+}
+
+// Fragment `index` of `count` of a URB_MSG with the given header fields,
+// carrying `chunk`, as PerfectLink::sendFragmented lays it out
+std::string fragment(uint64_t base, size_t index, size_t count, uint64_t seq,
+                     size_t total, const std::string &chunk) {
+  Message f;
+  f.type = MessageType::PL_FRAGMENT;
+  f.sender_id = 2;
+  f.seq_no = base + index;
+  f.original_sender_id = static_cast<uint32_t>(index);
+  f.original_seq_no = static_cast<uint32_t>(count);
+  f.payload = std::to_string(static_cast<int>(MessageType::URB_MSG)) + " " +
+              std::to_string(seq) + " 2 1 " + std::to_string(total) + " " +
+              chunk;
+  return f.serialize();
+}
+
+} // namespace
+
+int main() {
+  const size_t kChunk = 1300; // PerfectLink::kFragmentBytes
+  const std::string first(kChunk, 'a');
+  const std::string last(100, 'b');
+  const size_t total = first.size() + last.size();
+
+  // Each case gets a fresh link: a fragment's PL sequence number is
+  // consumed once seen, consistent or not
+  auto run = [&](const std::string &bad, bool completeAfter) {
+    NullTransport transport;
+    Collector upper;
+    PerfectLink<Collector> pl(1, transport, upper);
+    pl.receive(fragment(10, 0, 2, 7, total, first), 2);
+    pl.receive(bad, 2);
+    if (completeAfter) {
+      pl.receive(fragment(10, 1, 2, 7, total, last), 2);
+    }
+    return upper.delivered;
+  };
+
+  // Larger total: the chunk fits the claimed size but not the buffer
+  check(run(fragment(10, 1, 2, 7, 100000, std::string(50000, 'x')), false)
+            .empty(),
+        "fragment with a larger total was accepted");
+
+  // Same shape, different inner message
+  check(run(fragment(10, 1, 2, 8, total, last), false).empty(),
+        "fragment of another message was accepted");
+
+  // Larger count: fragment 2 of 3 would complete the message while its
+  // second half is still missing
+  std::vector<Message> delivered =
+      run(fragment(10, 2, 3, 7, 3 * kChunk, std::string(kChunk, 'x')), true);
+  check(delivered.size() == 1, "message not delivered once after a bad count");
+  if (delivered.size() == 1) {
+    check(delivered[0].type == MessageType::URB_MSG &&
+              delivered[0].seq_no == 7,
+          "reassembled header differs from the first fragment");
+    check(delivered[0].payload.view() == first + last,
+          "reassembled payload differs from the fragments sent");
+  }
+
+  if (failures == 0) {
+    std::cout << "fragment_test: OK\n";
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
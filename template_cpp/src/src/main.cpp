@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <thread>
@@ -7,6 +8,8 @@
 #include <sstream>
 #include <set>
 #include <optional>
+#include <charconv>
+#include <string_view>
 #include <cerrno>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -14,17 +17,88 @@
 #include <unistd.h>
 #include <cstring>
 #include <sys/time.h>
-#include <sys/select.h>
 #include <signal.h>
+#include <sched.h>
 
 #include "parser.hpp"
+#include "bench_stats.hpp"
+#include "metrics.hpp"
+#include "packet_capture.hpp"
+#include "trace.hpp"
 #include "hello.h"
-#include "perfect_link.hpp"
-#include "urb.hpp"
-#include "fifo_broadcast.hpp"
-#include "lattice_agreement.hpp"
+#include "udp_transport.hpp"
+#include "shm_transport.hpp"
+#include "uring_transport.hpp"
+#include "protocol_stack.hpp"
 
 static std::ofstream outputFile;
+static BenchStats benchStats;
+static std::string shmInboxPath;
+static PacketCapture capture;
+
+static MetricsRegistry metrics;
+static std::string metricsPath;
+static std::chrono::milliseconds metricsInterval(1000);
+static volatile sig_atomic_t metricsDumpRequested = 0;
+
+static void requestMetricsDump(int) { metricsDumpRequested = 1; }
+
+// Dump metrics when SIGUSR1 asked for it or the dump interval elapsed
+static void pollMetrics() {
+  if (metricsPath.empty()) {
+    return;
+  }
+
+  static auto nextDump = std::chrono::steady_clock::now();
+  auto now = std::chrono::steady_clock::now();
+  bool due = metricsInterval.count() > 0 && now >= nextDump;
+  if (metricsDumpRequested || due) {
+    metricsDumpRequested = 0;
+    metrics.writeJson(metricsPath);
+    nextDump = now + metricsInterval;
+  }
+}
+
+// Per-peer burst the socket buffers should absorb: one LA batch or a run
+// of FIFO broadcasts, in MTU-sized datagrams
+static constexpr int kSocketWindowBytes = 512 * 1500;
+static constexpr int kMinSocketBufferBytes = 1 << 20;
+static constexpr int kMaxSocketBufferBytes = 64 << 20;
+
+// Largest shared-memory inbox --shm auto creates: 32 processes' rings. It
+// stays in /dev/shm after a SIGKILL until a run on the same port replaces it.
+static constexpr size_t kMaxAutoShmBytes = 8 << 20;
+
+// Size SO_RCVBUF/SO_SNDBUF so a window from every peer fits. The FORCE
+// variants get past net.core.[rw]mem_max when we have CAP_NET_ADMIN; the
+// kernel clamps the plain ones otherwise. Returns the granted sizes.
+static std::pair<int, int> sizeSocketBuffers(int sockfd, size_t hosts) {
+  long want = static_cast<long>(hosts) * kSocketWindowBytes;
+  int bytes = static_cast<int>(std::min<long>(
+      std::max<long>(want, kMinSocketBufferBytes), kMaxSocketBufferBytes));
+  if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0) {
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+  }
+  if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUFFORCE, &bytes, sizeof(bytes)) < 0) {
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+  }
+
+  int rcv = 0;
+  int snd = 0;
+  socklen_t len = sizeof(int);
+  getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcv, &len);
+  len = sizeof(int);
+  getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &snd, &len);
+  return {rcv, snd};
+}
+
+// Pin the calling (protocol) thread to one core
+static bool pinToCpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(static_cast<size_t>(cpu), &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
 
 static void stop(int) {
   // reset signal handlers to default
@@ -41,10 +115,95 @@ static void stop(int) {
     outputFile.close();
   }
 
+  if (benchStats.enabled()) {
+    benchStats.write();
+  }
+
+  Tracer::instance().flush();
+  capture.flush();
+
+  if (!shmInboxPath.empty()) {
+    unlink(shmInboxPath.c_str());
+  }
+
   // exit directly from signal handler
   exit(0);
 }
 
+// Hand everything waiting in the shared-memory inbox to the perfect link,
+// then wait up to `timeoutUs` for datagrams on the socket. The wait is
+// skipped when the inbox had traffic. Returns false if nothing arrived.
+template <typename Link>
+static bool pollOnce(UringTransport &net, ShmTransport &shm, Link &pl,
+                     long timeoutUs) {
+  static std::string packet; // keeps its capacity across packets
+
+  auto deliver = [&pl](unsigned long from, const char *data, size_t size) {
+    // Empty datagrams are shm doorbells, only meant to wake us up
+    if (size == 0) {
+      return;
+    }
+    capture.datagram(from, data, size);
+    packet.assign(data, size);
+    pl.receive(packet, from);
+  };
+  size_t fromShm = shm.poll(deliver);
+  bool sleeping = fromShm == 0 && timeoutUs > 0 && shm.beginSleep();
+  bool fromSocket = net.poll(sleeping ? timeoutUs : 0, deliver);
+  if (sleeping) {
+    shm.endSleep();
+  }
+  return fromShm > 0 || fromSocket;
+}
+
+// FIFO deliveries: output file, or latency stats in benchmark mode
+struct FifoOutput {
+  void fifoDeliver(unsigned long from, const Message &msg) {
+    if (!benchStats.enabled()) {
+      outputFile << "d " << from << " " << msg.payload << "\n";
+      return;
+    }
+
+    // Benchmark payloads are "<seq>:<broadcast time>"
+    std::string_view payload(msg.payload);
+    size_t colon = payload.find(':');
+    uint64_t sentUs = 0;
+    if (colon != std::string_view::npos) {
+      std::from_chars(payload.data() + colon + 1, payload.data() + payload.size(), sentUs);
+    }
+    benchStats.onDelivery(sentUs, BenchStats::nowUs());
+    outputFile << "d " << from << " " << payload.substr(0, colon) << "\n";
+  }
+};
+
+// LA decisions, written in slot order
+struct DecisionOutput {
+  std::map<int, std::set<int>> pendingDecisions;
+  int nextSlotToPrint = 0;
+  uint64_t proposeStartUs = 0;
+
+  template <typename Set>
+  void decide(int slot, const Set &value) {
+    if (benchStats.enabled()) {
+      benchStats.onDelivery(proposeStartUs, BenchStats::nowUs());
+    }
+    pendingDecisions[slot] = std::set<int>(value.begin(), value.end());
+    while (pendingDecisions.count(nextSlotToPrint)) {
+      const auto &s = pendingDecisions[nextSlotToPrint];
+      bool first = true;
+      for (int x : s) {
+        if (!first) outputFile << " ";
+        outputFile << x;
+        first = false;
+      }
+      outputFile << "\n";
+      outputFile.flush(); // Keep flush for safety
+      pendingDecisions.erase(nextSlotToPrint);
+      nextSlotToPrint++;
+    }
+  }
+};
+
 int main(int argc, char **argv) {
   signal(SIGTERM, stop);
   signal(SIGINT, stop);
@@ -61,30 +220,81 @@ int main(int argc, char **argv) {
   auto hosts = parser.hosts();
   
   // Parse config file to determine mode
-  std::ifstream configFile(parser.configPath());
-  if (!configFile.is_open()) {
-    std::cerr << "Failed to open config file: " << parser.configPath() << std::endl;
-    return 1;
-  }
-  
-  std::string line;
-  if (!std::getline(configFile, line)) {
-      std::cerr << "Empty config file" << std::endl;
-      return 1;
-  }
-  
-  std::stringstream ss(line);
-  int val;
-  std::vector<int> configTokens;
-  while(ss >> val) configTokens.push_back(val);
-  
-  bool isLatticeAgreement = (configTokens.size() >= 3);
-  int numMessagesOrProposals = configTokens.empty() ? 0 : configTokens[0];
+  auto config = parser.config();
+
+  bool isLatticeAgreement = config.isLatticeAgreement();
+  int numMessagesOrProposals = config.header.empty() ? 0 : config.header[0];
   
   std::cout << "Config Mode: " << (isLatticeAgreement ? "Lattice Agreement" : "FIFO/PL") << "\n";
   std::cout << "Count: " << numMessagesOrProposals << "\n";
   std::cout << "Hosts count: " << hosts.size() << "\n\n";
 
+  // --bench FILE: record broadcast-to-delivery latency, written to FILE once
+  // everything was delivered and at exit
+  if (parser.hasOption("bench")) {
+    uint64_t expected = static_cast<uint64_t>(numMessagesOrProposals);
+    if (!isLatticeAgreement) {
+      expected *= hosts.size();
+    }
+    benchStats.enable(parser.option("bench"), parser.id(),
+                      isLatticeAgreement ? "la" : "fifo", expected);
+    std::cout << "Benchmark stats: " << parser.option("bench") << "\n\n";
+  }
+
+  // --metrics FILE: dump layer counters as JSON every --metrics-interval-ms
+  // (default 1000, 0 disables) and whenever SIGUSR1 arrives
+  if (parser.hasOption("metrics")) {
+    metricsPath = parser.option("metrics");
+    metricsInterval = std::chrono::milliseconds(
+        std::stol(parser.option("metrics-interval-ms", "1000")));
+    signal(SIGUSR1, requestMetricsDump);
+    std::cout << "Metrics: " << metricsPath << "\n\n";
+  }
+
+  // --trace FILE: binary event trace, needs a build with -DDA_TRACE=ON
+  if (parser.hasOption("trace")) {
+#ifdef DA_TRACE
+    if (!Tracer::instance().open(parser.option("trace"), static_cast<uint32_t>(parser.id()))) {
+      std::cerr << "Failed to open trace file" << std::endl;
+      return 1;
+    }
+    std::cout << "Trace: " << parser.option("trace") << "\n\n";
+#else
+    std::cerr << "Ignoring --trace: built without DA_TRACE" << std::endl;
+#endif
+  }
+
+  // --urb relay|vote|tree: URB dissemination, relay by default; vote sends
+  // the payload once, tree forwards it along a --urb-fanout-ary tree
+  UrbMode urbMode = UrbMode::Relay;
+  std::string urbModeName = parser.option("urb", "relay");
+  if (urbModeName == "vote") {
+    urbMode = UrbMode::Vote;
+  } else if (urbModeName == "tree") {
+    urbMode = UrbMode::Tree;
+  } else if (urbModeName != "relay") {
+    std::cerr << "Unknown --urb mode: " << urbModeName << std::endl;
+    return 1;
+  }
+  unsigned long urbFanout = std::stoul(parser.option(
+      "urb-fanout", std::to_string(kDefaultUrbFanout)));
+
+  // --capture FILE: record the received datagrams and local broadcasts or
+  // proposals for offline replay with da_replay
+  if (parser.hasOption("capture")) {
+    PacketCapture::Header header;
+    header.processId = static_cast<uint32_t>(parser.id());
+    header.hosts = static_cast<uint32_t>(hosts.size());
+    header.latticeAgreement = isLatticeAgreement ? 1 : 0;
+    header.urbMode = static_cast<uint8_t>(urbMode);
+    header.urbFanout = static_cast<uint32_t>(urbFanout);
+    if (!capture.open(parser.option("capture"), header)) {
+      std::cerr << "Failed to open capture file" << std::endl;
+      return 1;
+    }
+    std::cout << "Capture: " << parser.option("capture") << "\n\n";
+  }
+
   // Create UDP socket
   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   if (sockfd < 0) {
@@ -98,6 +308,36 @@ int main(int argc, char **argv) {
       return 1;
   }
 
+  auto [rcvBuf, sndBuf] = sizeSocketBuffers(sockfd, hosts.size());
+  std::cout << "Socket buffers: rcv " << rcvBuf << " snd " << sndBuf << "\n";
+
+  // --poll block|spin: spin never sleeps in the event loops, trading a core
+  // for wake-up latency; --busy-poll-us N makes the kernel busy-poll the
+  // device queue on receive (SO_BUSY_POLL); --cpu N pins us to core N
+  bool spin = false;
+  std::string pollName = parser.option("poll", "block");
+  if (pollName == "spin") {
+    spin = true;
+  } else if (pollName != "block") {
+    std::cerr << "Unknown --poll mode: " << pollName << std::endl;
+    return 1;
+  }
+  if (parser.hasOption("busy-poll-us")) {
+    int busyPollUs = std::stoi(parser.option("busy-poll-us"));
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) < 0) {
+      perror("setsockopt(SO_BUSY_POLL)");
+    }
+  }
+  if (parser.hasOption("cpu")) {
+    int cpu = std::stoi(parser.option("cpu"));
+    if (!pinToCpu(cpu)) {
+      perror("sched_setaffinity");
+    } else {
+      std::cout << "Pinned to CPU " << cpu << "\n";
+    }
+  }
+  std::cout << "\n";
+
   // Bind to our own port
   Parser::Host myHost;
   bool myHostFound = false;
@@ -134,126 +374,87 @@ int main(int argc, char **argv) {
       return 1;
   }
 
-  // Networking buffers
-  char buffer[65536];
-  struct sockaddr_in sender_addr;
-  socklen_t sender_len = sizeof(sender_addr);
+  UdpTransport udp(sockfd, hosts);
+
+  // --io select|uring: socket backend; uring batches sends and receives
+  // through io_uring and falls back to select if the kernel lacks it
+  UringTransport net(udp);
+  std::string ioName = parser.option("io", "select");
+  if (ioName == "uring") {
+    if (net.open()) {
+      std::cout << "Socket backend: io_uring\n\n";
+    } else {
+      std::cerr << "io_uring unavailable, using select" << std::endl;
+    }
+  } else if (ioName != "select") {
+    std::cerr << "Unknown --io backend: " << ioName << std::endl;
+    return 1;
+  }
+
+  // --shm auto|on|off: peers on this host (loopback or our own address) are
+  // sent to through shared-memory rings, the others over UDP. The inbox takes
+  // hosts x 256 KiB of /dev/shm, so auto only uses it up to kMaxAutoShmBytes.
+  ShmTransport shm(net, hosts, parser.id());
+  std::string shmName = parser.option("shm", "auto");
+  if (shmName != "auto" && shmName != "on" && shmName != "off") {
+    std::cerr << "Unknown --shm mode: " << shmName << std::endl;
+    return 1;
+  }
+  if (shmName == "on" ||
+      (shmName == "auto" && shm.segmentBytes() <= kMaxAutoShmBytes)) {
+    if (shm.open()) {
+      shmInboxPath = shm.inboxPath();
+      std::cout << "Shared memory inbox: " << shmInboxPath << "\n\n";
+    } else {
+      std::cerr << "Shared memory unavailable, using UDP only" << std::endl;
+    }
+  }
   
   if (isLatticeAgreement) {
       // --- Milestone 3: Lattice Agreement ---
       
-      // Parse Proposals
-      std::vector<std::set<int>> proposals;
-      for (int i = 0; i < numMessagesOrProposals; ++i) {
-          if (std::getline(configFile, line)) {
-              std::set<int> p;
-              std::stringstream pss(line);
-              int v;
-              while (pss >> v) p.insert(v);
-              proposals.push_back(p);
-          }
-      }
-      configFile.close();
-      
-      // Output Ordering Logic
-      std::map<int, std::set<int>> pendingDecisions;
-      int nextSlotToPrint = 0;
+      const std::vector<std::set<int>>& proposals = config.proposals;
       
-      auto decideCallback = [&](int slot, const std::set<int>& value) {
-           pendingDecisions[slot] = value;
-           while (pendingDecisions.count(nextSlotToPrint)) {
-               const auto& s = pendingDecisions[nextSlotToPrint];
-               bool first = true;
-               for (int x : s) {
-                   if (!first) outputFile << " ";
-                   outputFile << x;
-                   first = false;
-               }
-               outputFile << "\n";
-               outputFile.flush(); // Keep flush for safety
-               nextSlotToPrint++;
-           }
-      };
-      
-      // Setup Layers
-      LatticeAgreement* laPtr = nullptr;
-      
-      auto plDeliver = [&](unsigned long from, const Message& msg) {
-          // Only route LA messages to LatticeAgreement
-          if (msg.type == MessageType::LA_PROPOSAL || 
-              msg.type == MessageType::LA_ACK || 
-              msg.type == MessageType::LA_NACK) {
-              if (laPtr) laPtr->receive(from, msg);
-          }
-      };
-      
-      PerfectLink pl(parser.id(), sockfd, hosts, plDeliver);
-      LatticeAgreement la(parser.id(), pl, static_cast<int>(hosts.size()), decideCallback);
-      laPtr = &la;
+      DecisionOutput output;
+      LatticeStack<DecisionOutput> stack(parser.id(), shm, static_cast<int>(hosts.size()), output);
+      stack.registerMetrics(metrics);
+      shm.registerMetrics(metrics);
+      net.registerMetrics(metrics);
+      NodePoolStats::registerMetrics(metrics);
       
       // Start Agreement for all slots
+      output.proposeStartUs = BenchStats::nowUs();
       for (int i = 0; i < static_cast<int>(proposals.size()); ++i) {
-          la.propose(i, proposals[i]);
+          if (benchStats.enabled()) {
+              benchStats.onBroadcast(output.proposeStartUs);
+          }
+          capture.propose(i, proposals[i]);
+          stack.la.propose(i, proposals[i]);
       }
+      stack.update(); // sends the batched proposals
       
       // Event Loop
       // Continue processing network messages even after deciding all slots
       // so we can help other nodes catch up.
       while (true) {
-          fd_set readfds;
-          FD_ZERO(&readfds);
-          FD_SET(sockfd, &readfds);
-          
-          struct timeval tv;
-          tv.tv_sec = 0;
-          tv.tv_usec = 1000; // 1ms
-          
-          int ready = select(sockfd + 1, &readfds, nullptr, nullptr, &tv);
-          
-          if (ready > 0 && FD_ISSET(sockfd, &readfds)) {
-              memset(buffer, 0, sizeof(buffer));
-              ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, 
-                               reinterpret_cast<struct sockaddr *>(&sender_addr), &sender_len);
-              if (n > 0) {
-                  std::string data(buffer, n);
-                  pl.receive(data, sender_addr);
-              }
-          }
+          pollOnce(net, shm, stack.pl, spin ? 0 : 1000); // 1ms
           
-          pl.update();
+          stack.update();
+          pollMetrics();
           
           // Optional: Break if signal received (handled by signal handler anyway)
       }
       
   } else {
       // --- Milestone 1 & 2: Perfect Links / FIFO ---
-      configFile.close();
       
-      // FIFO Callback
-      auto fifoDeliver = [&](unsigned long from, const Message& msg) {
-          outputFile << "d " << from << " " << msg.payload << "\n"; 
-      };
-
-      UniformReliableBroadcast* urbPtr = nullptr;
-      FIFOBroadcast* fifoPtr = nullptr;
-      
-      auto plDeliver = [&](unsigned long from, const Message& msg) {
-          if (msg.type == MessageType::URB_MSG) {
-              if (urbPtr) urbPtr->deliver(from, msg);
-          }
-      };
-      
-      PerfectLink pl(parser.id(), sockfd, hosts, plDeliver);
-      
-      auto urbDeliver = [&](unsigned long from, const Message& msg) {
-          if (fifoPtr) fifoPtr->deliver(from, msg);
-      };
-      
-      UniformReliableBroadcast urb(parser.id(), pl, static_cast<int>(hosts.size()), urbDeliver);
-      urbPtr = &urb;
-      
-      FIFOBroadcast fifo(parser.id(), urb, fifoDeliver);
-      fifoPtr = &fifo;
+      FifoOutput output;
+      FifoStack<FifoOutput> stack(parser.id(), shm, static_cast<int>(hosts.size()), output,
+                                  urbMode, urbFanout);
+      stack.registerMetrics(metrics);
+      shm.registerMetrics(metrics);
+      net.registerMetrics(metrics);
+      NodePoolStats::registerMetrics(metrics);
 
       // Broadcast loop
       std::cout << "Broadcasting " << numMessagesOrProposals << " messages...\n";
@@ -262,59 +463,28 @@ int main(int argc, char **argv) {
           Message msg;
           msg.type = MessageType::URB_MSG;
           msg.payload = std::to_string(i);
+          if (benchStats.enabled()) {
+              uint64_t nowUs = BenchStats::nowUs();
+              benchStats.onBroadcast(nowUs);
+              msg.payload += ":" + std::to_string(nowUs);
+          }
           
-          fifo.broadcast(msg);
+          capture.broadcast(msg.payload);
+          stack.fifo.broadcast(msg);
           outputFile << "b " << i << "\n";
           
           // Drain queue
-          while (true) {
-              fd_set readfds;
-              FD_ZERO(&readfds);
-              FD_SET(sockfd, &readfds);
-              
-              struct timeval tv;
-              tv.tv_sec = 0;
-              tv.tv_usec = 0;
-              
-              int ready = select(sockfd + 1, &readfds, nullptr, nullptr, &tv);
-              
-              if (ready > 0 && FD_ISSET(sockfd, &readfds)) {
-                   memset(buffer, 0, sizeof(buffer));
-                   ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, 
-                                    reinterpret_cast<struct sockaddr *>(&sender_addr), &sender_len);
-                   if (n > 0) {
-                       std::string data(buffer, n);
-                       pl.receive(data, sender_addr);
-                   }
-              } else {
-                  break;
-              }
+          while (pollOnce(net, shm, stack.pl, 0)) {
           }
-          pl.update();
+          stack.update();
+          pollMetrics();
       }
       
       // Final event loop
       while (true) {
-          fd_set readfds;
-          FD_ZERO(&readfds);
-          FD_SET(sockfd, &readfds);
-          
-          struct timeval tv;
-          tv.tv_sec = 0;
-          tv.tv_usec = 10000; // 10ms
-          
-          int ready = select(sockfd + 1, &readfds, nullptr, nullptr, &tv);
-          
-          if (ready > 0 && FD_ISSET(sockfd, &readfds)) {
-              memset(buffer, 0, sizeof(buffer));
-              ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, 
-                               reinterpret_cast<struct sockaddr *>(&sender_addr), &sender_len);
-              if (n > 0) {
-                  std::string data(buffer, n);
-                  pl.receive(data, sender_addr);
-              }
-          }
-          pl.update();
+          pollOnce(net, shm, stack.pl, spin ? 0 : 10000); // 10ms
+          stack.update();
+          pollMetrics();
       }
   }
 
@@ -0,0 +1,187 @@
+// Replays a capture written by `da_proc --capture FILE` through a fresh
+// protocol stack at full speed, without sockets, and reports the processing
+// cost per datagram. The stack sees the recorded timestamps as its clock, so
+// timers (retransmissions, URB payload requests) fire as in the original run
+// and every replay of a capture does the same work.
+//
+// Usage: da_replay CAPTURE [--repeat N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "packet_capture.hpp"
+#include "protocol_stack.hpp"
+#include "transport.hpp"
+
+namespace {
+
+using WallClock = std::chrono::steady_clock;
+
+// Counts outgoing datagrams; time is the timestamp of the current record
+class ReplayTransport : public Transport {
+public:
+  void send(unsigned long, const std::string &data) override {
+    packets++;
+    bytes += data.size();
+  }
+
+  Clock::time_point now() const override {
+    return Clock::time_point(std::chrono::microseconds(nowUs));
+  }
+
+  uint64_t nowUs = 0;
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+};
+
+struct ReplaySink {
+  uint64_t delivered = 0;
+
+  void fifoDeliver(unsigned long, const Message &) { delivered++; }
+  template <typename Set> void decide(int, const Set &) { delivered++; }
+};
+
+struct ReplayResult {
+  uint64_t datagrams = 0;
+  uint64_t datagramBytes = 0;
+  uint64_t delivered = 0;
+  uint64_t packetsSent = 0;
+  uint64_t bytesSent = 0;
+  uint64_t capturedUs = 0;
+  double wallSeconds = 0;
+};
+
+// Feeds every record to the stack, running its timers after each one the
+// way the event loop of da_proc does
+template <typename Stack>
+ReplayResult replay(std::string_view records, ReplayTransport &transport,
+                    ReplaySink &sink, Stack &stack) {
+  ReplayResult result;
+  std::string packet;
+  PacketCapture::Record record;
+  uint64_t timeUs = 0;
+
+  auto start = WallClock::now();
+  while (PacketCapture::nextRecord(records, timeUs, record)) {
+    transport.nowUs = record.timeUs;
+    switch (record.kind) {
+    case PacketCapture::Kind::Datagram:
+      packet.assign(record.data.data(), record.data.size());
+      stack.pl.receive(packet, record.id);
+      result.datagrams++;
+      result.datagramBytes += record.data.size();
+      break;
+    case PacketCapture::Kind::Broadcast:
+      if constexpr (std::is_same_v<Stack, FifoStack<ReplaySink>>) {
+        Message msg;
+        msg.type = MessageType::URB_MSG;
+        msg.payload = record.data;
+        stack.fifo.broadcast(msg);
+      }
+      break;
+    case PacketCapture::Kind::Propose:
+      if constexpr (std::is_same_v<Stack, LatticeStack<ReplaySink>>) {
+        std::set<int> values;
+        std::string_view rest = record.data;
+        int value;
+        while (MappedFile::nextNumber(rest, value)) {
+          values.insert(value);
+        }
+        stack.la.propose(static_cast<int>(record.id), values);
+      }
+      break;
+    default:
+      break;
+    }
+    stack.update();
+  }
+  result.wallSeconds =
+      std::chrono::duration<double>(WallClock::now() - start).count();
+
+  result.delivered = sink.delivered;
+  result.packetsSent = transport.packets;
+  result.bytesSent = transport.bytes;
+  result.capturedUs = timeUs;
+  return result;
+}
+
+ReplayResult replayOnce(const PacketCapture::Header &header,
+                        std::string_view records) {
+  ReplayTransport transport;
+  ReplaySink sink;
+  int hosts = static_cast<int>(header.hosts);
+  if (header.latticeAgreement != 0) {
+    LatticeStack<ReplaySink> stack(header.processId, transport, hosts, sink);
+    return replay(records, transport, sink, stack);
+  }
+  FifoStack<ReplaySink> stack(header.processId, transport, hosts, sink,
+                              static_cast<UrbMode>(header.urbMode),
+                              header.urbFanout);
+  return replay(records, transport, sink, stack);
+}
+
+[[noreturn]] void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " CAPTURE [--repeat N]\n";
+  exit(EXIT_FAILURE);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 2 && !(argc == 4 && std::strcmp(argv[2], "--repeat") == 0)) {
+    usage(argv[0]);
+  }
+  int repeat = argc == 4 ? std::atoi(argv[3]) : 1;
+  if (repeat < 1) {
+    usage(argv[0]);
+  }
+
+  MappedFile file(argv[1]);
+  PacketCapture::Header header;
+  if (!PacketCapture::readHeader(file.view(), header)) {
+    std::cerr << "`" << argv[1] << "` is not a capture file\n";
+    return 1;
+  }
+  std::string_view records = file.view().substr(PacketCapture::kHeaderBytes);
+
+  // Best of --repeat runs; the first one also pages the capture in
+  std::vector<ReplayResult> runs;
+  for (int i = 0; i < repeat; ++i) {
+    runs.push_back(replayOnce(header, records));
+  }
+  const ReplayResult &best = *std::min_element(
+      runs.begin(), runs.end(), [](const ReplayResult &a, const ReplayResult &b) {
+        return a.wallSeconds < b.wallSeconds;
+      });
+
+  std::cout << "mode: " << (header.latticeAgreement != 0 ? "la" : "fifo") << "\n";
+  std::cout << "process: " << header.processId << "\n";
+  std::cout << "hosts: " << header.hosts << "\n";
+  std::cout << "datagrams: " << best.datagrams << "\n";
+  std::cout << "datagram_bytes: " << best.datagramBytes << "\n";
+  std::cout << "captured_us: " << best.capturedUs << "\n";
+  std::cout << "deliveries: " << best.delivered << "\n";
+  std::cout << "packets_sent: " << best.packetsSent << "\n";
+  std::cout << "bytes_sent: " << best.bytesSent << "\n";
+  std::cout << "runs: " << runs.size() << "\n";
+  std::cout << "wall_us: "
+            << static_cast<uint64_t>(best.wallSeconds * 1e6) << "\n";
+  if (best.datagrams > 0 && best.wallSeconds > 0) {
+    double datagrams = static_cast<double>(best.datagrams);
+    std::cout << "ns_per_datagram: "
+              << static_cast<uint64_t>(best.wallSeconds * 1e9 / datagrams)
+              << "\n";
+    std::cout << "datagrams_per_sec: "
+              << static_cast<uint64_t>(datagrams / best.wallSeconds) << "\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,302 @@
+// Runs the protocol stack for many processes in one binary on top of the
+// simulated network and reports message complexity and delivery latency in
+// virtual time.
+//
+// Usage: da_sim [--mode fifo|la] [--urb relay|vote|tree] [--fanout K]
+//               [--procs N] [--messages M] [--seed S]
+//               [--latency-us US] [--jitter-us US] [--loss P]
+//               [--reorder P] [--reorder-delay-us US] [--bandwidth BPS]
+//               [--tick-us US] [--max-time-ms MS] [--vs K] [--ds D]
+//               [--crash ID,ID,...]
+//
+// In `la` mode --messages is the number of slots; every process proposes
+// --vs random values out of 1..--ds per slot. Processes listed in --crash
+// are crashed from the start: they never send, and datagrams to them are
+// lost. Completion then means every correct process delivered the messages
+// of every correct process.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sim_network.hpp"
+#include "protocol_stack.hpp"
+
+namespace {
+
+struct SimOptions {
+  std::string mode = "fifo";
+  std::string urb = "relay";
+  unsigned long fanout = kDefaultUrbFanout;
+  int procs = 10;
+  int messages = 100;
+  uint64_t tickUs = 10000;
+  uint64_t maxTimeMs = 600000;
+  int vs = 3;
+  int ds = 10;
+  std::vector<unsigned long> crash;
+  SimConfig net;
+};
+
+// Deliveries and decisions of all processes: latency samples in virtual time
+struct SimSink {
+  const SimNetwork &net;
+  // FIFO: broadcast time per (origin, seq)
+  std::map<std::pair<unsigned long, unsigned long>, uint64_t> broadcastAtUs;
+  std::vector<uint64_t> latencies;
+  uint64_t delivered = 0;
+
+  void fifoDeliver(unsigned long from, const Message &msg) {
+    auto it = broadcastAtUs.find({from, msg.original_seq_no});
+    if (it != broadcastAtUs.end()) {
+      latencies.push_back(net.nowUs() - it->second);
+    }
+    delivered++;
+  }
+
+  template <typename Set> void decide(int, const Set &) {
+    latencies.push_back(net.nowUs());
+    delivered++;
+  }
+};
+
+// One simulated process with its own copy of the layer stack
+struct SimProcess {
+  std::unique_ptr<SimTransport> transport;
+  std::unique_ptr<FifoStack<SimSink>> fifo;
+  std::unique_ptr<LatticeStack<SimSink>> la;
+
+  void update() {
+    if (fifo) {
+      fifo->update();
+    } else {
+      la->update();
+    }
+  }
+
+  void receive(const std::string &data, unsigned long from) {
+    if (fifo) {
+      fifo->pl.receive(data, from);
+    } else {
+      la->pl.receive(data, from);
+    }
+  }
+};
+
+[[noreturn]] void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0
+            << " [--mode fifo|la] [--urb relay|vote|tree] [--fanout K] [--procs N] [--messages M] [--seed S]"
+               " [--latency-us US] [--jitter-us US] [--loss P] [--reorder P]"
+               " [--reorder-delay-us US] [--bandwidth BPS] [--tick-us US]"
+               " [--max-time-ms MS] [--vs K] [--ds D] [--crash ID,ID,...]\n";
+  exit(EXIT_FAILURE);
+}
+
+SimOptions parseOptions(int argc, char **argv) {
+  SimOptions opt;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+    }
+    const char *key = argv[i];
+    const char *val = argv[++i];
+    if (std::strcmp(key, "--mode") == 0) {
+      opt.mode = val;
+    } else if (std::strcmp(key, "--urb") == 0) {
+      opt.urb = val;
+    } else if (std::strcmp(key, "--fanout") == 0) {
+      opt.fanout = std::strtoul(val, nullptr, 10);
+    } else if (std::strcmp(key, "--procs") == 0) {
+      opt.procs = std::atoi(val);
+    } else if (std::strcmp(key, "--messages") == 0) {
+      opt.messages = std::atoi(val);
+    } else if (std::strcmp(key, "--seed") == 0) {
+      opt.net.seed = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--latency-us") == 0) {
+      opt.net.latencyUs = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--jitter-us") == 0) {
+      opt.net.jitterUs = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--loss") == 0) {
+      opt.net.lossRate = std::atof(val);
+    } else if (std::strcmp(key, "--reorder") == 0) {
+      opt.net.reorderRate = std::atof(val);
+    } else if (std::strcmp(key, "--reorder-delay-us") == 0) {
+      opt.net.reorderDelayUs = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--bandwidth") == 0) {
+      opt.net.bandwidthBytesPerSec = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--tick-us") == 0) {
+      opt.tickUs = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--max-time-ms") == 0) {
+      opt.maxTimeMs = std::strtoull(val, nullptr, 10);
+    } else if (std::strcmp(key, "--vs") == 0) {
+      opt.vs = std::atoi(val);
+    } else if (std::strcmp(key, "--ds") == 0) {
+      opt.ds = std::atoi(val);
+    } else if (std::strcmp(key, "--crash") == 0) {
+      for (const char *p = val; *p != '\0';) {
+        char *end;
+        opt.crash.push_back(std::strtoul(p, &end, 10));
+        p = *end == ',' ? end + 1 : end;
+        if (end == p && *p != '\0') {
+          usage(argv[0]);
+        }
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (opt.procs < 1 || opt.messages < 0 || opt.tickUs == 0 ||
+      (opt.mode != "fifo" && opt.mode != "la") ||
+      (opt.urb != "relay" && opt.urb != "vote" && opt.urb != "tree")) {
+    usage(argv[0]);
+  }
+  for (unsigned long id : opt.crash) {
+    if (id < 1 || id > static_cast<unsigned long>(opt.procs)) {
+      usage(argv[0]);
+    }
+  }
+  return opt;
+}
+
+void printLatencies(const char *name, std::vector<uint64_t> &samples) {
+  if (samples.empty()) {
+    std::cout << name << "_samples: 0\n";
+    return;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  uint64_t sum = 0;
+  for (uint64_t s : samples) {
+    sum += s;
+  }
+  auto pct = [&](double p) {
+    size_t idx = static_cast<size_t>(p * static_cast<double>(samples.size() - 1));
+    return samples[idx];
+  };
+
+  std::cout << name << "_samples: " << samples.size() << "\n";
+  std::cout << name << "_mean_us: " << sum / samples.size() << "\n";
+  std::cout << name << "_p50_us: " << pct(0.50) << "\n";
+  std::cout << name << "_p99_us: " << pct(0.99) << "\n";
+  std::cout << name << "_max_us: " << samples.back() << "\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  SimOptions opt = parseOptions(argc, argv);
+  bool isLatticeAgreement = opt.mode == "la";
+  size_t n = static_cast<size_t>(opt.procs);
+
+  SimNetwork net(n, opt.net);
+  std::vector<SimProcess> procs(n + 1);
+  std::vector<bool> crashed(n + 1, false);
+  for (unsigned long id : opt.crash) {
+    crashed[id] = true;
+  }
+  uint64_t correct = static_cast<uint64_t>(std::count(crashed.begin() + 1, crashed.end(), false));
+
+  SimSink sink{net, {}, {}, 0};
+  sink.latencies.reserve(n * n * static_cast<size_t>(opt.messages));
+
+  UrbMode urbMode = UrbMode::Relay;
+  if (opt.urb == "vote") {
+    urbMode = UrbMode::Vote;
+  } else if (opt.urb == "tree") {
+    urbMode = UrbMode::Tree;
+  }
+
+  for (unsigned long id = 1; id <= n; ++id) {
+    SimProcess &p = procs[id];
+    p.transport = std::make_unique<SimTransport>(net, id);
+
+    if (isLatticeAgreement) {
+      p.la = std::make_unique<LatticeStack<SimSink>>(id, *p.transport, opt.procs, sink);
+    } else {
+      p.fifo = std::make_unique<FifoStack<SimSink>>(id, *p.transport, opt.procs, sink,
+                                                    urbMode, opt.fanout);
+    }
+
+    if (!crashed[id]) {
+      net.attach(id, [&p](unsigned long from, const std::string &data) {
+        p.receive(data, from);
+      });
+    }
+  }
+
+  // Everything is started at virtual time 0
+  uint64_t expected;
+  if (isLatticeAgreement) {
+    std::mt19937_64 rng(opt.net.seed);
+    for (unsigned long id = 1; id <= n; ++id) {
+      if (crashed[id]) {
+        continue;
+      }
+      for (int slot = 0; slot < opt.messages; ++slot) {
+        std::set<int> proposal;
+        for (int k = 0; k < opt.vs; ++k) {
+          proposal.insert(1 + static_cast<int>(rng() % static_cast<uint64_t>(std::max(opt.ds, 1))));
+        }
+        procs[id].la->la.propose(slot, proposal);
+      }
+      procs[id].update(); // sends the batched proposals
+    }
+    expected = correct * static_cast<uint64_t>(opt.messages);
+  } else {
+    for (unsigned long id = 1; id <= n; ++id) {
+      if (crashed[id]) {
+        continue;
+      }
+      for (int i = 1; i <= opt.messages; ++i) {
+        Message msg;
+        msg.type = MessageType::URB_MSG;
+        msg.payload = std::to_string(i);
+        sink.broadcastAtUs[{id, static_cast<unsigned long>(i)}] = net.nowUs();
+        procs[id].fifo->fifo.broadcast(msg);
+      }
+    }
+    expected = correct * correct * static_cast<uint64_t>(opt.messages);
+  }
+
+  // Advance virtual time in ticks, running retransmissions between them
+  uint64_t maxTimeUs = opt.maxTimeMs * 1000;
+  while (sink.delivered < expected && net.nowUs() < maxTimeUs) {
+    net.runUntil(net.nowUs() + opt.tickUs);
+    for (unsigned long id = 1; id <= n; ++id) {
+      if (!crashed[id]) {
+        procs[id].update();
+      }
+    }
+  }
+
+  const SimNetwork::Stats &stats = net.stats();
+  uint64_t operations = n * static_cast<uint64_t>(opt.messages);
+  std::cout << "mode: " << opt.mode << "\n";
+  if (!isLatticeAgreement) {
+    std::cout << "urb: " << opt.urb << "\n";
+  }
+  std::cout << "procs: " << n << "\n";
+  std::cout << "messages: " << opt.messages << "\n";
+  std::cout << "seed: " << opt.net.seed << "\n";
+  std::cout << "completed: " << (sink.delivered >= expected ? "yes" : "no") << "\n";
+  std::cout << "deliveries: " << sink.delivered << "/" << expected << "\n";
+  std::cout << "virtual_time_us: " << net.nowUs() << "\n";
+  std::cout << "packets_sent: " << stats.packetsSent << "\n";
+  std::cout << "packets_dropped: " << stats.packetsDropped << "\n";
+  std::cout << "bytes_sent: " << stats.bytesSent << "\n";
+  if (operations > 0) {
+    std::cout << "packets_per_op: " << stats.packetsSent / operations << "\n";
+    std::cout << "bytes_per_op: " << stats.bytesSent / operations << "\n";
+  }
+  printLatencies(isLatticeAgreement ? "decide" : "delivery", sink.latencies);
+
+  return sink.delivered >= expected ? 0 : 1;
+}
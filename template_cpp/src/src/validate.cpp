@@ -0,0 +1,458 @@
+// Checks the outputs of a FIFO broadcast or lattice agreement run. Every
+// output and config is memory mapped and parsed in place, one worker thread
+// per core, so multi-million line runs validate in seconds.
+//
+// Usage: da_validate fifo CONFIG OUTPUT_DIR PROCESSES
+//        da_validate la CONFIG_DIR OUTPUT_DIR PROCESSES
+//
+// Outputs are OUTPUT_DIR/procNN.output (as written by tools/stress.py) or
+// OUTPUT_DIR/N.output; lattice agreement configs are CONFIG_DIR/procNN.config
+// or CONFIG_DIR/lattice-agreement-N.config. A process without an output
+// file is taken to have crashed before writing it and is skipped.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+namespace {
+
+// Violations printed per process (or per block of slots) before the rest
+// are only counted
+constexpr size_t kMaxReported = 10;
+
+// Slots handed to a worker at a time by the cross-process LA checks
+constexpr size_t kSlotBlock = 1024;
+
+struct Report {
+  std::vector<std::string> messages;
+  size_t failures = 0;
+
+  template <typename... Args> void fail(const Args &...args) {
+    if (failures++ < kMaxReported) {
+      std::ostringstream os;
+      (os << ... << args);
+      messages.push_back(os.str());
+    }
+  }
+
+  // Prints the reports in order; true if none of them failed
+  static bool print(const std::vector<Report> &reports) {
+    bool ok = true;
+    for (const Report &report : reports) {
+      for (const std::string &message : report.messages) {
+        std::cout << "  [FAIL] " << message << "\n";
+      }
+      if (report.failures > report.messages.size()) {
+        std::cout << "  ... and " << report.failures - report.messages.size()
+                  << " more\n";
+      }
+      ok = ok && report.failures == 0;
+    }
+    return ok;
+  }
+};
+
+// Runs `fn(i)` for every i in [0, count) on one thread per core
+template <typename Fn> void parallelFor(size_t count, const Fn &fn) {
+  size_t workers = std::min<size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u), count);
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  threads.reserve(workers);
+  for (size_t t = 0; t < workers; ++t) {
+    threads.emplace_back([&] {
+      for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) <
+                     count;) {
+        fn(i);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool exists(const std::string &path) { return ::access(path.c_str(), F_OK) == 0; }
+
+// First of `candidates` that exists, or the empty string
+std::string findFile(std::initializer_list<std::string> candidates) {
+  for (const std::string &path : candidates) {
+    if (exists(path)) {
+      return path;
+    }
+  }
+  return std::string();
+}
+
+std::string procName(unsigned long id) {
+  std::string name = std::to_string(id);
+  return "proc" + std::string(name.size() < 2 ? 1 : 0, '0') + name;
+}
+
+std::string outputPath(const std::string &dir, unsigned long id) {
+  return findFile({dir + "/" + procName(id) + ".output",
+                   dir + "/" + std::to_string(id) + ".output"});
+}
+
+// Parses the remaining numbers of a line, sorted and without duplicates;
+// false on anything that is not a number
+bool parseSet(std::string_view line, std::vector<int> &values) {
+  values.clear();
+  int value;
+  while (MappedFile::nextNumber(line, value)) {
+    values.push_back(value);
+  }
+  MappedFile::skipSpaces(line);
+  std::sort(values.begin(), values.end());
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  return line.empty();
+}
+
+std::string format(const std::vector<int> &values) {
+  std::ostringstream os;
+  os << "{";
+  for (size_t i = 0; i < values.size(); ++i) {
+    os << (i > 0 ? " " : "") << values[i];
+  }
+  os << "}";
+  return os.str();
+}
+
+// --- FIFO broadcast ---
+
+struct FifoLog {
+  bool present = false;
+  uint64_t broadcasts = 0;
+  uint64_t deliveries = 0;
+  // Indexed by sender: number of its messages delivered, which FIFO order
+  // makes the highest sequence number delivered
+  std::vector<uint64_t> delivered;
+};
+
+// Checks one output on its own: broadcasts are 1..k in order, and the
+// deliveries of every sender are 1, 2, 3, ... (FIFO order, no duplicates,
+// no message from outside the run)
+void checkFifoOutput(const std::string &path, unsigned long id,
+                     unsigned long processes, uint64_t messages, FifoLog &log,
+                     Report &report) {
+  MappedFile file(path.c_str());
+  log.present = true;
+  log.delivered.assign(processes + 1, 0);
+
+  std::string_view rest = file.view();
+  std::string_view line;
+  for (uint64_t lineNo = 1; MappedFile::nextLine(rest, line); ++lineNo) {
+    std::string_view kind = MappedFile::nextToken(line);
+    if (kind.empty()) {
+      continue;
+    }
+    uint64_t seq = 0;
+    if (kind == "b") {
+      if (!MappedFile::nextNumber(line, seq)) {
+        report.fail("process ", id, " line ", lineNo, ": malformed broadcast");
+      } else if (seq != log.broadcasts + 1 || seq > messages) {
+        report.fail("process ", id, " line ", lineNo, ": broadcast ", seq,
+                    " after ", log.broadcasts, " of ", messages);
+      }
+      log.broadcasts = std::max(log.broadcasts + 1, seq);
+      continue;
+    }
+
+    unsigned long from = 0;
+    if (kind != "d" || !MappedFile::nextNumber(line, from) ||
+        !MappedFile::nextNumber(line, seq)) {
+      report.fail("process ", id, " line ", lineNo, ": malformed line");
+      continue;
+    }
+    log.deliveries++;
+    if (from < 1 || from > processes || seq < 1 || seq > messages) {
+      report.fail("process ", id, " line ", lineNo, ": delivered ", from, " ",
+                  seq, ", which no process broadcast");
+      continue;
+    }
+    uint64_t &last = log.delivered[from];
+    if (seq <= last) {
+      report.fail("process ", id, " line ", lineNo, ": delivered ", from, " ",
+                  seq, " again");
+    } else {
+      if (seq != last + 1) {
+        report.fail("process ", id, " line ", lineNo, ": delivered ", from,
+                    " ", seq, " before ", from, " ", last + 1);
+      }
+      last = seq;
+    }
+  }
+}
+
+bool validateFifo(const char *configPath, const std::string &outputDir,
+                  unsigned long processes) {
+  MappedFile config(configPath);
+  std::string_view header = config.view();
+  uint64_t messages = 0;
+  if (!MappedFile::nextNumber(header, messages)) {
+    std::cerr << "`" << configPath << "` does not start with a message count\n";
+    return false;
+  }
+
+  std::vector<FifoLog> logs(processes + 1);
+  std::vector<Report> reports(processes + 1);
+  parallelFor(processes, [&](size_t i) {
+    unsigned long id = i + 1;
+    std::string path = outputPath(outputDir, id);
+    if (path.empty()) {
+      return;
+    }
+    try {
+      checkFifoOutput(path, id, processes, messages, logs[id], reports[id]);
+    } catch (const std::exception &e) {
+      reports[id].fail("process ", id, ": ", e.what());
+    }
+  });
+
+  // No creation, against what the senders logged. A sender stopped between
+  // broadcasting and logging its `b` line can have one message delivered
+  // that it never logged.
+  uint64_t deliveries = 0;
+  unsigned long present = 0;
+  for (unsigned long id = 1; id <= processes; ++id) {
+    const FifoLog &log = logs[id];
+    if (!log.present) {
+      continue;
+    }
+    present++;
+    deliveries += log.deliveries;
+    for (unsigned long from = 1; from <= processes; ++from) {
+      if (logs[from].present &&
+          log.delivered[from] > logs[from].broadcasts + 1) {
+        reports[id].fail("process ", id, ": delivered ", from, " ",
+                         log.delivered[from], " but ", from, " logged ",
+                         logs[from].broadcasts, " broadcasts");
+      }
+    }
+  }
+
+  std::cout << "Checked " << deliveries << " FIFO deliveries of " << present
+            << "/" << processes << " processes (" << messages
+            << " messages each).\n";
+  return Report::print(reports);
+}
+
+// --- Lattice agreement ---
+
+struct LaLog {
+  std::vector<std::vector<int>> proposals;
+  std::vector<std::vector<int>> decisions;
+  bool present = false;
+};
+
+void loadLaProcess(const std::string &configPath, const std::string &path,
+                   unsigned long id, LaLog &log, Report &report) {
+  MappedFile config(configPath.c_str());
+  std::string_view rest = config.view();
+  std::string_view line;
+  int numProposals = 0;
+  if (!MappedFile::nextLine(rest, line) ||
+      !MappedFile::nextNumber(line, numProposals) || numProposals < 0) {
+    report.fail("process ", id, ": `", configPath, "` has no proposal count");
+    return;
+  }
+  log.proposals.resize(static_cast<size_t>(numProposals));
+  for (auto &proposal : log.proposals) {
+    if (!MappedFile::nextLine(rest, line) || !parseSet(line, proposal)) {
+      report.fail("process ", id, ": `", configPath, "` has ",
+                  &proposal - log.proposals.data(), " of ", numProposals,
+                  " proposals");
+      return;
+    }
+  }
+
+  if (path.empty()) {
+    return;
+  }
+  log.present = true;
+  MappedFile output(path.c_str());
+  rest = output.view();
+  for (size_t slot = 0; MappedFile::nextLine(rest, line); ++slot) {
+    // Integrity: one decision per slot, and only for slots we proposed in
+    if (slot >= log.proposals.size()) {
+      report.fail("process ", id, ": more decisions than its ",
+                  log.proposals.size(), " proposals");
+      return;
+    }
+    log.decisions.emplace_back();
+    if (!parseSet(line, log.decisions.back())) {
+      report.fail("process ", id, " slot ", slot, ": malformed decision");
+    }
+  }
+
+  // Validity, first half: our proposal is part of our decision
+  for (size_t slot = 0; slot < log.decisions.size(); ++slot) {
+    const std::vector<int> &decided = log.decisions[slot];
+    const std::vector<int> &proposed = log.proposals[slot];
+    if (!std::includes(decided.begin(), decided.end(), proposed.begin(),
+                       proposed.end())) {
+      report.fail("process ", id, " slot ", slot, ": decided ",
+                  format(decided), " without its proposal ", format(proposed));
+    }
+  }
+}
+
+// Validity, second half: decisions only hold proposed values. Consistency:
+// the decisions of a slot form a chain under inclusion, which holds iff,
+// ordered by size, each one includes the previous.
+void checkSlot(const std::vector<LaLog> &logs, size_t slot,
+               std::vector<int> &proposed,
+               std::vector<const std::vector<int> *> &decided, Report &report) {
+  proposed.clear();
+  decided.clear();
+  for (unsigned long id = 1; id < logs.size(); ++id) {
+    const LaLog &log = logs[id];
+    if (slot < log.proposals.size()) {
+      proposed.insert(proposed.end(), log.proposals[slot].begin(),
+                      log.proposals[slot].end());
+    }
+    if (slot < log.decisions.size()) {
+      decided.push_back(&log.decisions[slot]);
+    }
+  }
+  if (decided.empty()) {
+    return;
+  }
+  std::sort(proposed.begin(), proposed.end());
+  proposed.erase(std::unique(proposed.begin(), proposed.end()), proposed.end());
+
+  auto ownerOf = [&](const std::vector<int> *set) {
+    for (unsigned long id = 1; id < logs.size(); ++id) {
+      if (slot < logs[id].decisions.size() && &logs[id].decisions[slot] == set) {
+        return id;
+      }
+    }
+    return 0ul;
+  };
+
+  for (const std::vector<int> *set : decided) {
+    if (!std::includes(proposed.begin(), proposed.end(), set->begin(),
+                       set->end())) {
+      report.fail("process ", ownerOf(set), " slot ", slot, ": decided ",
+                  format(*set), ", not a subset of the proposals ",
+                  format(proposed));
+    }
+  }
+
+  std::sort(decided.begin(), decided.end(),
+            [](const std::vector<int> *a, const std::vector<int> *b) {
+              return a->size() < b->size();
+            });
+  for (size_t i = 1; i < decided.size(); ++i) {
+    const std::vector<int> &small = *decided[i - 1];
+    const std::vector<int> &large = *decided[i];
+    if (!std::includes(large.begin(), large.end(), small.begin(),
+                       small.end())) {
+      report.fail("slot ", slot, ": process ", ownerOf(&small), " decided ",
+                  format(small), " and process ", ownerOf(&large), " decided ",
+                  format(large), ", which are incomparable");
+    }
+  }
+}
+
+bool validateLa(const std::string &configDir, const std::string &outputDir,
+                unsigned long processes) {
+  std::vector<std::string> configs(processes + 1);
+  for (unsigned long id = 1; id <= processes; ++id) {
+    configs[id] = findFile(
+        {configDir + "/" + procName(id) + ".config",
+         configDir + "/lattice-agreement-" + std::to_string(id) + ".config"});
+    if (configs[id].empty()) {
+      std::cerr << "No config for process " << id << " in `" << configDir
+                << "`\n";
+      return false;
+    }
+  }
+
+  std::vector<LaLog> logs(processes + 1);
+  std::vector<Report> loadReports(processes + 1);
+  parallelFor(processes, [&](size_t i) {
+    unsigned long id = i + 1;
+    try {
+      loadLaProcess(configs[id], outputPath(outputDir, id), id, logs[id],
+                    loadReports[id]);
+    } catch (const std::exception &e) {
+      loadReports[id].fail("process ", id, ": ", e.what());
+    }
+  });
+
+  size_t slots = 0;
+  size_t decisions = 0;
+  unsigned long present = 0;
+  for (const LaLog &log : logs) {
+    slots = std::max(slots, log.proposals.size());
+    decisions += log.decisions.size();
+    present += log.present ? 1 : 0;
+  }
+
+  size_t blocks = (slots + kSlotBlock - 1) / kSlotBlock;
+  std::vector<Report> slotReports(blocks);
+  parallelFor(blocks, [&](size_t block) {
+    std::vector<int> proposed;
+    std::vector<const std::vector<int> *> decided;
+    size_t end = std::min(slots, (block + 1) * kSlotBlock);
+    for (size_t slot = block * kSlotBlock; slot < end; ++slot) {
+      checkSlot(logs, slot, proposed, decided, slotReports[block]);
+    }
+  });
+
+  std::cout << "Checked " << decisions << " decisions in " << slots
+            << " slots of " << present << "/" << processes << " processes.\n";
+  bool loaded = Report::print(loadReports);
+  return Report::print(slotReports) && loaded;
+}
+
+[[noreturn]] void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " fifo CONFIG OUTPUT_DIR PROCESSES\n"
+            << "       " << argv0 << " la CONFIG_DIR OUTPUT_DIR PROCESSES\n";
+  exit(EXIT_FAILURE);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    usage(argv[0]);
+  }
+  long processes = std::atol(argv[4]);
+  if (processes < 1) {
+    usage(argv[0]);
+  }
+  unsigned long n = static_cast<unsigned long>(processes);
+
+  bool ok;
+  try {
+    if (std::strcmp(argv[1], "fifo") == 0) {
+      ok = validateFifo(argv[2], argv[3], n);
+    } else if (std::strcmp(argv[1], "la") == 0) {
+      ok = validateLa(argv[2], argv[3], n);
+    } else {
+      usage(argv[0]);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    ok = false;
+  }
+
+  std::cout << (ok ? "\nSUCCESS: All checks passed!\n"
+                   : "\nFAILURE: Some checks failed.\n");
+  return ok ? 0 : 1;
+}
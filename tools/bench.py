@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import signal
+import subprocess
+import sys
+import time
+
+from stress import (
+    Validation,
+    LatticeAgreementValidation,
+    positive_int,
+)
+
+
+def startProcesses(binary, processes, hostsFile, configFiles, logsDir):
+    procs = []
+    for pid in range(1, processes + 1):
+        configFile = configFiles[(pid - 1) % len(configFiles)]
+        cmd = [
+            binary,
+            "--id",
+            str(pid),
+            "--hosts",
+            hostsFile,
+            "--output",
+            os.path.join(logsDir, "proc{:02d}.output".format(pid)),
+            configFile,
+            "--bench",
+            os.path.join(logsDir, "proc{:02d}.bench.json".format(pid)),
+        ]
+
+        stdoutFd = open(os.path.join(logsDir, "proc{:02d}.stdout".format(pid)), "w")
+        stderrFd = open(os.path.join(logsDir, "proc{:02d}.stderr".format(pid)), "w")
+        procs.append((pid, subprocess.Popen(cmd, stdout=stdoutFd, stderr=stderrFd)))
+
+    return procs
+
+
+def percentile(buckets, total, q):
+    rank = min(max(int(q * total), 1), total)
+    seen = 0
+    for value, count in buckets:
+        seen += count
+        if seen >= rank:
+            return value
+    return buckets[-1][0] if buckets else 0
+
+
+def aggregate(stats):
+    merged = {}
+    for s in stats:
+        for value, count in s["histogram"]:
+            merged[value] = merged.get(value, 0) + count
+
+    buckets = sorted(merged.items())
+    total = sum(count for _, count in buckets)
+    durationUs = max(s["duration_us"] for s in stats)
+    deliveries = sum(s["deliveries"] for s in stats)
+
+    return {
+        "processes": len(stats),
+        "broadcasts": sum(s["broadcasts"] for s in stats),
+        "deliveries": deliveries,
+        "max_duration_us": durationUs,
+        "throughput_per_sec": deliveries / (durationUs / 1e6) if durationUs else 0.0,
+        "latency_us": {
+            "p50": percentile(buckets, total, 0.50),
+            "p99": percentile(buckets, total, 0.99),
+            "p999": percentile(buckets, total, 0.999),
+            "max": max(s["latency_us"]["max"] for s in stats),
+        },
+    }
+
+
+def main(args):
+    logsDir = os.path.abspath(args.logsDir)
+    if not os.path.isdir(logsDir):
+        raise ValueError("Directory `{}` does not exist".format(logsDir))
+
+    binary = os.path.abspath(args.binary)
+    if not os.path.isfile(binary):
+        raise ValueError("`{}` is not a file, build da_proc first".format(binary))
+
+    if args.command == "fifo":
+        validation = Validation(args.processes, args.messages)
+        hostsFile, configFile = validation.generateFifoConfig(logsDir)
+        configFiles = [configFile]
+    else:
+        validation = LatticeAgreementValidation(
+            args.processes,
+            args.proposals,
+            args.proposal_max_values,
+            args.proposals_distinct_values,
+        )
+        hostsFile, configFiles = validation.generate(logsDir)
+
+    benchFiles = [
+        os.path.join(logsDir, "proc{:02d}.bench.json".format(pid))
+        for pid in range(1, args.processes + 1)
+    ]
+    for path in benchFiles:
+        if os.path.exists(path):
+            os.remove(path)
+
+    procs = startProcesses(binary, args.processes, hostsFile, configFiles, logsDir)
+    try:
+        # Processes write their results once they delivered everything
+        deadline = time.time() + args.timeout
+        while time.time() < deadline:
+            if all(os.path.exists(path) for path in benchFiles):
+                break
+            time.sleep(0.1)
+        else:
+            print("Timeout: not all deliveries completed", file=sys.stderr)
+
+        for _, p in procs:
+            p.send_signal(signal.SIGTERM)
+        for _, p in procs:
+            p.wait()
+    finally:
+        for _, p in procs:
+            p.kill()
+
+    stats = []
+    for path in benchFiles:
+        with open(path) as f:
+            stats.append(json.load(f))
+
+    summary = aggregate(stats)
+    summary["command"] = args.command
+    print(json.dumps(summary, indent=2))
+
+    with open(os.path.join(logsDir, "bench.json"), "w") as f:
+        json.dump(summary, f, indent=2)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Run local da_proc processes in --bench mode and aggregate "
+        "their throughput and latency percentiles"
+    )
+
+    sub_parsers = parser.add_subparsers(dest="command", help="benchmark a given milestone")
+    sub_parsers.required = True
+    parser_fifo = sub_parsers.add_parser("fifo", help="benchmark fifo broadcast")
+    parser_agreement = sub_parsers.add_parser(
+        "agreement", help="benchmark lattice agreement"
+    )
+
+    for subparser in [parser_fifo, parser_agreement]:
+        subparser.add_argument(
+            "-b",
+            "--binary",
+            required=True,
+            dest="binary",
+            help="Path to the da_proc binary",
+        )
+
+        subparser.add_argument(
+            "-l",
+            "--logs",
+            required=True,
+            dest="logsDir",
+            help="Directory to store outputs and per-process benchmark results",
+        )
+
+        subparser.add_argument(
+            "-p",
+            "--processes",
+            required=True,
+            type=positive_int,
+            dest="processes",
+            help="Number of processes",
+        )
+
+        subparser.add_argument(
+            "-t",
+            "--timeout",
+            default=60,
+            type=positive_int,
+            dest="timeout",
+            help="Seconds to wait for all deliveries before stopping",
+        )
+
+    parser_fifo.add_argument(
+        "-m",
+        "--messages",
+        required=True,
+        type=positive_int,
+        dest="messages",
+        help="Number of messages that each process broadcasts",
+    )
+
+    parser_agreement.add_argument(
+        "-n",
+        "--proposals",
+        required=True,
+        type=positive_int,
+        dest="proposals",
+        help="Number of proposals that each process makes",
+    )
+
+    parser_agreement.add_argument(
+        "-v",
+        "--proposal-values",
+        required=True,
+        type=positive_int,
+        dest="proposal_max_values",
+        help="Maximum size of the proposal set that each process proposes",
+    )
+
+    parser_agreement.add_argument(
+        "-d",
+        "--distinct-values",
+        required=True,
+        type=positive_int,
+        dest="proposals_distinct_values",
+        help="The number of distinct values among all proposals",
+    )
+
+    main(parser.parse_args())
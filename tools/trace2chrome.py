@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import struct
+import sys
+
+# Must match TraceKind in template_cpp/src/include/trace.hpp
+KINDS = [
+    ("send", ("seq", "type")),
+    ("receive", ("seq", "type")),
+    ("ack", ("seq", None)),
+    ("retransmit", ("seq", "type")),
+    ("relay", ("origin", "origin_seq")),
+    ("urb_deliver", ("origin", "origin_seq")),
+    ("fifo_deliver", ("origin", "origin_seq")),
+    ("propose", ("slot", "proposal")),
+    ("la_ack", ("slot", "proposal")),
+    ("nack", ("slot", "proposal")),
+    ("decide", ("slot", "rounds")),
+]
+
+MAGIC = b"DATRACE1"
+EVENT = struct.Struct("<QQQIB3x")
+
+
+def readTrace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if data[:8] != MAGIC:
+        raise ValueError("`{}` is not a trace file".format(path))
+
+    processId, eventSize = struct.unpack_from("<II", data, 8)
+    if eventSize != EVENT.size:
+        raise ValueError("`{}` has {} byte events, expected {}".format(path, eventSize, EVENT.size))
+
+    events = []
+    for offset in range(16, len(data) - EVENT.size + 1, EVENT.size):
+        events.append(EVENT.unpack_from(data, offset))
+    return processId, events
+
+
+def convert(paths):
+    traceEvents = []
+    flows = {}
+
+    for path in paths:
+        processId, events = readTrace(path)
+        traceEvents.append(
+            {
+                "ph": "M",
+                "name": "process_name",
+                "pid": processId,
+                "args": {"name": "process {}".format(processId)},
+            }
+        )
+
+        for tsNs, a, b, peer, kind in events:
+            name, argNames = KINDS[kind] if kind < len(KINDS) else ("kind{}".format(kind), ("a", "b"))
+            args = {}
+            if peer:
+                args["peer"] = peer
+            if argNames[0]:
+                args[argNames[0]] = a
+            if argNames[1]:
+                args[argNames[1]] = b
+
+            ts = tsNs / 1000.0
+            traceEvents.append(
+                {"name": name, "ph": "i", "s": "t", "ts": ts, "pid": processId, "tid": 0, "args": args}
+            )
+
+            # Connect each first send of a packet with its receipt on the peer
+            if name == "send":
+                key = (processId, peer, a)
+            elif name == "receive":
+                key = (peer, processId, a)
+            else:
+                continue
+
+            flowId = flows.setdefault(key, len(flows) + 1)
+            traceEvents.append(
+                {
+                    "name": "packet",
+                    "cat": "pl",
+                    "ph": "s" if name == "send" else "f",
+                    "bp": "e",
+                    "id": flowId,
+                    "ts": ts,
+                    "pid": processId,
+                    "tid": 0,
+                }
+            )
+
+    return {"traceEvents": traceEvents, "displayTimeUnit": "ns"}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Convert da_proc binary traces (--trace) into one Chrome trace / Perfetto JSON file"
+    )
+    parser.add_argument("traces", nargs="+", help="Trace files, one per process")
+    parser.add_argument("-o", "--output", default="-", help="Output JSON file (default: stdout)")
+    args = parser.parse_args()
+
+    result = convert(args.traces)
+    if args.output == "-":
+        json.dump(result, sys.stdout)
+    else:
+        with open(args.output, "w") as f:
+            json.dump(result, f)